@@ -89,6 +89,176 @@ CONFIG_GETTER(getGlobalPass) {
   return sdscatprintf(ss, "Password: *******");
 }
 
+// TOPOLOGY_SNAPSHOT
+CONFIG_SETTER(setTopologySnapshot) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  int acrc = AC_GetString(ac, &realConfig->topologySnapshot, NULL, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getTopologySnapshot) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  return sdscatprintf(ss, "%s", realConfig->topologySnapshot ? realConfig->topologySnapshot : "");
+}
+
+// PACKED_ROWS
+CONFIG_SETTER(setPackedRows) {
+  const char *s;
+  int acrc = AC_GetString(ac, &s, NULL, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  if (!strcasecmp(s, "true")) {
+    realConfig->packedRows = 1;
+  } else if (!strcasecmp(s, "false")) {
+    realConfig->packedRows = 0;
+  } else {
+    QueryError_SetError(status, QUERY_EPARSEARGS, NULL);
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getPackedRows) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  return sdscatprintf(ss, "%s", realConfig->packedRows ? "true" : "false");
+}
+
+// REPLY_COMPRESSION_THRESHOLD
+CONFIG_SETTER(setReplyCompression) {
+  long long ll;
+  int acrc = AC_GetLongLong(ac, &ll, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  if (ll < 0) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, NULL);
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  realConfig->replyCompression = ll;
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getReplyCompression) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  return sdscatprintf(ss, "%zu", realConfig->replyCompression);
+}
+
+// TWO_PHASE_SEARCH
+CONFIG_SETTER(setTwoPhaseSearch) {
+  const char *s;
+  int acrc = AC_GetString(ac, &s, NULL, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  if (!strcasecmp(s, "true")) {
+    realConfig->twoPhaseSearch = 1;
+  } else if (!strcasecmp(s, "false")) {
+    realConfig->twoPhaseSearch = 0;
+  } else {
+    QueryError_SetError(status, QUERY_EPARSEARGS, NULL);
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getTwoPhaseSearch) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  return sdscatprintf(ss, "%s", realConfig->twoPhaseSearch ? "true" : "false");
+}
+
+// TOPK_PRUNING
+CONFIG_SETTER(setTopkPruning) {
+  const char *s;
+  int acrc = AC_GetString(ac, &s, NULL, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  if (!strcasecmp(s, "true")) {
+    realConfig->topkPruning = 1;
+  } else if (!strcasecmp(s, "false")) {
+    realConfig->topkPruning = 0;
+  } else {
+    QueryError_SetError(status, QUERY_EPARSEARGS, NULL);
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getTopkPruning) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  return sdscatprintf(ss, "%s", realConfig->topkPruning ? "true" : "false");
+}
+
+// SEARCHAFTER_FORWARDING
+CONFIG_SETTER(setSearchAfterForwarding) {
+  const char *s;
+  int acrc = AC_GetString(ac, &s, NULL, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  if (!strcasecmp(s, "true")) {
+    realConfig->searchAfterForwarding = 1;
+  } else if (!strcasecmp(s, "false")) {
+    realConfig->searchAfterForwarding = 0;
+  } else {
+    QueryError_SetError(status, QUERY_EPARSEARGS, NULL);
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getSearchAfterForwarding) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  return sdscatprintf(ss, "%s", realConfig->searchAfterForwarding ? "true" : "false");
+}
+
+// APPROXCOUNT_FORWARDING
+CONFIG_SETTER(setApproxCountForwarding) {
+  const char *s;
+  int acrc = AC_GetString(ac, &s, NULL, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  if (!strcasecmp(s, "true")) {
+    realConfig->approxCountForwarding = 1;
+  } else if (!strcasecmp(s, "false")) {
+    realConfig->approxCountForwarding = 0;
+  } else {
+    QueryError_SetError(status, QUERY_EPARSEARGS, NULL);
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getApproxCountForwarding) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  return sdscatprintf(ss, "%s", realConfig->approxCountForwarding ? "true" : "false");
+}
+
 static RSConfigOptions clusterOptions_g = {
     .vars =
         {
@@ -105,6 +275,37 @@ static RSConfigOptions clusterOptions_g = {
               .helpText = "Global oss cluster password that will be used to connect to other shards",
               .setValue = setGlobalPass,
               .getValue = getGlobalPass},
+            {.name = "TOPOLOGY_SNAPSHOT",
+             .helpText = "File to persist the last known cluster topology to, and load it from on "
+                         "startup",
+             .setValue = setTopologySnapshot,
+             .getValue = getTopologySnapshot,
+             .flags = RSCONFIGVAR_F_IMMUTABLE},
+            {.name = "PACKED_ROWS",
+             .helpText = "Request aggregate rows from shards in a packed binary encoding",
+             .setValue = setPackedRows,
+             .getValue = getPackedRows},
+            {.name = "REPLY_COMPRESSION_THRESHOLD",
+             .helpText = "Ask shards to compress replies larger than this many bytes, 0 to disable",
+             .setValue = setReplyCompression,
+             .getValue = getReplyCompression,
+             .flags = RSCONFIGVAR_F_IMMUTABLE},
+            {.name = "TWO_PHASE_SEARCH",
+             .helpText = "Search shards without content, then fetch it only for the returned page",
+             .setValue = setTwoPhaseSearch,
+             .getValue = getTwoPhaseSearch},
+            {.name = "TOPK_PRUNING",
+             .helpText = "Search shards for a share of the top results first, to prune the rest",
+             .setValue = setTopkPruning,
+             .getValue = getTopkPruning},
+            {.name = "SEARCHAFTER_FORWARDING",
+             .helpText = "Forward SEARCHAFTER to the shards, which need to support it",
+             .setValue = setSearchAfterForwarding,
+             .getValue = getSearchAfterForwarding},
+            {.name = "APPROXCOUNT_FORWARDING",
+             .helpText = "Forward APPROXCOUNT to the shards, which need to support it",
+             .setValue = setApproxCountForwarding,
+             .getValue = getApproxCountForwarding},
             {.name = NULL}
             // fin
         }
@@ -12,6 +12,20 @@ typedef struct {
   MRClusterType type;
   int timeoutMS;
   const char* globalPass;
+  /* Path of the file the last known topology is persisted to, NULL if disabled */
+  const char* topologySnapshot;
+  /* Ask shards for aggregate rows in the packed binary encoding */
+  int packedRows;
+  /* Shard replies larger than this many bytes are sent compressed, 0 if disabled */
+  size_t replyCompression;
+  /* Search without content first, and fetch it only for the returned page */
+  int twoPhaseSearch;
+  /* Search the shards for a share of the top results first, and again only where needed */
+  int topkPruning;
+  /* Forward SEARCHAFTER to the shards, which need to support it */
+  int searchAfterForwarding;
+  /* Forward APPROXCOUNT to the shards, which need to support it */
+  int approxCountForwarding;
 } SearchClusterConfig;
 
 extern SearchClusterConfig clusterConfig;
@@ -22,6 +36,9 @@ extern SearchClusterConfig clusterConfig;
 #define DEFAULT_CLUSTER_CONFIG                                                             \
   (SearchClusterConfig) {                                                                  \
     .numPartitions = 0, .type = DetectClusterType(), .timeoutMS = 500, .globalPass = NULL, \
+    .topologySnapshot = NULL, .packedRows = 0, .replyCompression = 0,                      \
+    .twoPhaseSearch = 0, .topkPruning = 0, .searchAfterForwarding = 0,                     \
+    .approxCountForwarding = 0,                                                            \
   }
 
 /* Detect the cluster type, by trying to see if we are running inside RLEC.
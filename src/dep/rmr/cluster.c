@@ -6,6 +6,11 @@
 #include <dep/rmutil/vector.h>
 
 #include <stdlib.h>
+#include <string.h>
+
+/* Base delay before re-sending a command that got a TRYAGAIN or CLUSTERDOWN error. The delay is
+ * multiplied by the attempt number */
+#define MRCLUSTER_RETRY_BACKOFF_MS 20
 
 void _MRClsuter_UpdateNodes(MRCluster *cl) {
   if (cl->topo) {
@@ -61,14 +66,21 @@ void _MRClsuter_UpdateNodes(MRCluster *cl) {
   }
 }
 
+/* The key hash of a shard function */
+static KeyShardFunc keyShardFunc(ShardFunc sf) {
+  return sf == CRC12ShardFunc ? CRC12KeyShardFunc : CRC16KeyShardFunc;
+}
+
 MRCluster *MR_NewCluster(MRClusterTopology *initialTopolgy, ShardFunc sf,
                          long long minTopologyUpdateInterval) {
   MRCluster *cl = malloc(sizeof(MRCluster));
   cl->sf = sf;
+  cl->ksf = keyShardFunc(sf);
   cl->topologyUpdateMinInterval = minTopologyUpdateInterval;
   cl->lastTopologyUpdate = 0;
   cl->topo = initialTopolgy;
   cl->nodeMap = NULL;
+  cl->movedSlots = NULL;
   cl->myNode = NULL;  // tODO: discover local ip/port
   MRConnManager_Init(&cl->mgr, MR_CONN_POOL_SIZE);
 
@@ -89,6 +101,15 @@ MRClusterShard *_MRCluster_FindShard(MRCluster *cl, uint slot) {
   return NULL;
 }
 
+MRClusterShard *MRCluster_ShardForKey(MRCluster *cl, const char *key, size_t len,
+                                      mr_slot_t *slot) {
+  if (!cl || !cl->topo) {
+    return NULL;
+  }
+  *slot = cl->ksf(key, len, cl->topo->numSlots);
+  return _MRCluster_FindShard(cl, *slot);
+}
+
 /* Select a node from the shard according to the coordination strategy */
 MRClusterNode *_MRClusterShard_SelectNode(MRClusterShard *sh, MRClusterNode *myNode,
                                           MRCoordinationStrategy strategy) {
@@ -139,6 +160,241 @@ MRClusterNode *_MRClusterShard_SelectNode(MRClusterShard *sh, MRClusterNode *myN
   return NULL;
 }
 
+/* Get a connection to one of the shard's nodes other than the given one, or to the given one if
+ * no other node is connected. Used to fail over to a replica on TRYAGAIN or connection loss */
+static MRConn *_MRClusterShard_GetAlternateConn(MRCluster *cl, MRClusterShard *sh,
+                                                MRCoordinationStrategy strategy,
+                                                const char *excludeId, MRClusterNode **node) {
+  MRClusterNode *excluded = NULL;
+  for (int i = 0; i < sh->numNodes; i++) {
+    MRClusterNode *n = &sh->nodes[i];
+    if (strategy & MRCluster_MastersOnly && !(n->flags & MRNode_Master)) continue;
+    if (excludeId && !strcmp(n->id, excludeId)) {
+      excluded = n;
+      continue;
+    }
+    // MRConn_Get only returns connected connections
+    MRConn *conn = MRConn_Get(&cl->mgr, n->id);
+    if (conn) {
+      *node = n;
+      return conn;
+    }
+  }
+  *node = excluded;
+  return excluded ? MRConn_Get(&cl->mgr, excluded->id) : NULL;
+}
+
+/* Find the shard a node belongs to by the node's id */
+static MRClusterShard *_MRCluster_FindNodeShard(MRCluster *cl, const char *id) {
+  for (int sh = 0; sh < cl->topo->numShards; sh++) {
+    for (int n = 0; n < cl->topo->shards[sh].numNodes; n++) {
+      if (!strcmp(cl->topo->shards[sh].nodes[n].id, id)) {
+        return &cl->topo->shards[sh];
+      }
+    }
+  }
+  return NULL;
+}
+
+int MRCluster_ParseRedirect(MRReply *r, int *isAsk, mr_slot_t *slot, const char **addr,
+                            size_t *addrLen) {
+  if (MRReply_Type(r) != MR_REPLY_ERROR) return 0;
+
+  size_t len;
+  const char *str = MRReply_String(r, &len);
+  const char *p;
+  if (len > 6 && !strncmp(str, "MOVED ", 6)) {
+    *isAsk = 0;
+    p = str + 6;
+  } else if (len > 4 && !strncmp(str, "ASK ", 4)) {
+    *isAsk = 1;
+    p = str + 4;
+  } else {
+    return 0;
+  }
+
+  const char *end = str + len;
+  mr_slot_t sl = 0;
+  const char *digits = p;
+  while (p < end && *p >= '0' && *p <= '9') {
+    sl = sl * 10 + (*p++ - '0');
+  }
+  if (p == digits || p >= end || *p != ' ') return 0;
+  p++;
+  if (p >= end) return 0;
+
+  *slot = sl;
+  *addr = p;
+  *addrLen = end - p;
+  return 1;
+}
+
+/* The context of an idempotent command that is re-sent on redirections and transient errors. It
+ * wraps the caller's callback and privdata, and is freed once the final reply is passed on */
+typedef struct {
+  MRCluster *cl;
+  MRCoordinationStrategy strategy;
+  MRCommand *cmd;
+  redisCallbackFn *fn;
+  void *privdata;
+  /* The id of the node we last sent the command to */
+  char *nodeId;
+  /* The target slot, or -1 for fanout commands that target a specific node */
+  int slot;
+  int attempts;
+  /* Redirection target and error type of the last reply, used by deferred retries */
+  char *redirectAddr;
+  MRReplyRetryType retryType;
+  uv_timer_t timer;
+  int timerInit;
+} MRRetryCtx;
+
+static void retryCallback(redisAsyncContext *c, void *r, void *privdata);
+
+static MRRetryCtx *newRetryCtx(MRCluster *cl, MRCoordinationStrategy strategy, MRCommand *cmd,
+                               int slot, redisCallbackFn *fn, void *privdata) {
+  MRRetryCtx *rc = calloc(1, sizeof(*rc));
+  rc->cl = cl;
+  rc->strategy = strategy;
+  rc->cmd = cmd;
+  rc->slot = slot;
+  rc->fn = fn;
+  rc->privdata = privdata;
+  return rc;
+}
+
+static void freeRetryCtxCB(uv_handle_t *h) {
+  free(h->data);
+}
+
+static void freeRetryCtx(MRRetryCtx *rc) {
+  free(rc->nodeId);
+  free(rc->redirectAddr);
+  if (rc->timerInit) {
+    // the timer handle is embedded in the context, so we can only free it once the loop let go
+    uv_close((uv_handle_t *)&rc->timer, freeRetryCtxCB);
+  } else {
+    free(rc);
+  }
+}
+
+/* Send the retry context's command to a node, recording the node as the last one we tried */
+static int retryCtx_Send(MRRetryCtx *rc, MRConn *conn, MRClusterNode *node, int asking) {
+  if (!conn || !node) return REDIS_ERR;
+  if (asking && MRConn_SendAsking(conn) == REDIS_ERR) return REDIS_ERR;
+  if (MRConn_SendCommand(conn, rc->cmd, retryCallback, rc) == REDIS_ERR) return REDIS_ERR;
+
+  if (!rc->nodeId || strcmp(rc->nodeId, node->id)) {
+    free(rc->nodeId);
+    rc->nodeId = strdup(node->id);
+  }
+  return REDIS_OK;
+}
+
+/* Re-send a command after a failed attempt, according to the failure type */
+static int retryCtx_Resend(MRRetryCtx *rc) {
+  MRCluster *cl = rc->cl;
+  if (!cl->topo || !cl->nodeMap) return REDIS_ERR;
+
+  if (rc->retryType == MRReply_Moved || rc->retryType == MRReply_Ask) {
+    MRClusterNode *node =
+        MRNodeMap_FindByAddress(cl->nodeMap, rc->redirectAddr, strlen(rc->redirectAddr));
+    if (!node) return REDIS_ERR;
+    return retryCtx_Send(rc, MRConn_Get(&cl->mgr, node->id), node,
+                         rc->retryType == MRReply_Ask);
+  }
+
+  // TRYAGAIN or connection loss - try another node in the same shard, or the same node again
+  MRClusterShard *sh = rc->slot >= 0 ? _MRCluster_FindShard(cl, rc->slot)
+                                     : _MRCluster_FindNodeShard(cl, rc->nodeId);
+  if (!sh) return REDIS_ERR;
+  MRClusterNode *node;
+  MRConn *conn = _MRClusterShard_GetAlternateConn(cl, sh, rc->strategy, rc->nodeId, &node);
+  return retryCtx_Send(rc, conn, node, 0);
+}
+
+MRReplyRetryType MRCluster_RetryType(MRReply *r, int attempts) {
+  if (attempts >= MRCLUSTER_MAX_RETRIES) return MRReply_Final;
+  if (!r) return MRReply_ConnLost;
+  if (MRReply_Type(r) != MR_REPLY_ERROR) return MRReply_Final;
+
+  size_t len;
+  const char *str = MRReply_String(r, &len);
+  if (len >= 6 && !strncmp(str, "MOVED ", 6)) return MRReply_Moved;
+  if (len >= 4 && !strncmp(str, "ASK ", 4)) return MRReply_Ask;
+  if ((len >= 8 && !strncmp(str, "TRYAGAIN", 8)) ||
+      (len >= 11 && !strncmp(str, "CLUSTERDOWN", 11))) {
+    return MRReply_TryAgain;
+  }
+  return MRReply_Final;
+}
+
+static void retryTimerCB(uv_timer_t *timer) {
+  MRRetryCtx *rc = timer->data;
+  if (retryCtx_Resend(rc) == REDIS_ERR) {
+    // nothing left to try - tell the caller the node could not be reached
+    rc->fn(NULL, NULL, rc->privdata);
+    freeRetryCtx(rc);
+  }
+}
+
+static void retryCallback(redisAsyncContext *c, void *r, void *privdata) {
+  MRRetryCtx *rc = privdata;
+  MRReplyRetryType type = MRCluster_RetryType(r, rc->attempts);
+
+  if (type == MRReply_Final) {
+    rc->fn(c, r, rc->privdata);
+    freeRetryCtx(rc);
+    return;
+  }
+  rc->attempts++;
+  rc->retryType = type;
+
+  if (type == MRReply_Moved || type == MRReply_Ask) {
+    int isAsk;
+    mr_slot_t slot;
+    const char *addr;
+    size_t addrLen;
+    if (!MRCluster_ParseRedirect(r, &isAsk, &slot, &addr, &addrLen)) {
+      rc->fn(c, r, rc->privdata);
+      freeRetryCtx(rc);
+      return;
+    }
+    free(rc->redirectAddr);
+    rc->redirectAddr = strndup(addr, addrLen);
+
+    // remember where the slot has moved, so that new commands go directly to its new owner
+    MRCluster *cl = rc->cl;
+    MRClusterNode *node = NULL;
+    if (type == MRReply_Moved && cl->topo && cl->nodeMap && slot < cl->topo->numSlots &&
+        (node = MRNodeMap_FindByAddress(cl->nodeMap, addr, addrLen))) {
+      if (!cl->movedSlots) {
+        cl->movedSlots = calloc(cl->topo->numSlots, sizeof(*cl->movedSlots));
+      }
+      cl->movedSlots[slot] = node;
+    }
+  }
+
+  if (type == MRReply_TryAgain) {
+    // the cluster is in a transient state, give it some time before re-sending
+    if (!rc->timerInit) {
+      uv_timer_init(uv_default_loop(), &rc->timer);
+      rc->timer.data = rc;
+      rc->timerInit = 1;
+    }
+    MRReply_Free(r);
+    uv_timer_start(&rc->timer, retryTimerCB, MRCLUSTER_RETRY_BACKOFF_MS * rc->attempts, 0);
+    return;
+  }
+
+  if (retryCtx_Resend(rc) == REDIS_ERR) {
+    rc->fn(c, r, rc->privdata);
+    freeRetryCtx(rc);
+    return;
+  }
+  if (r) MRReply_Free(r);
+}
+
 /* Send a single command to the right shard in the cluster, with an optoinal control over node
  * selection */
 int MRCluster_SendCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCommand *cmd,
@@ -160,9 +416,28 @@ int MRCluster_SendCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRComm
   MRClusterNode *node = _MRClusterShard_SelectNode(sh, cl->myNode, strategy);
   if (!node) return REDIS_ERR;
 
-  MRConn *conn = MRConn_Get(&cl->mgr, node->id);
-  if (!conn) return REDIS_ERR;
-  return MRConn_SendCommand(conn, cmd, fn, privdata);
+  if (!(MRCommand_GetFlags(cmd) & MRCommand_Idempotent)) {
+    MRConn *conn = MRConn_Get(&cl->mgr, node->id);
+    if (!conn) return REDIS_ERR;
+    return MRConn_SendCommand(conn, cmd, fn, privdata);
+  }
+
+  /* We already know the slot has moved since the last topology update */
+  if (cl->movedSlots && slot < cl->topo->numSlots && cl->movedSlots[slot]) {
+    node = cl->movedSlots[slot];
+  }
+
+  MRRetryCtx *rc = newRetryCtx(cl, strategy, cmd, slot, fn, privdata);
+  if (retryCtx_Send(rc, MRConn_Get(&cl->mgr, node->id), node, 0) == REDIS_OK) {
+    return REDIS_OK;
+  }
+  /* The selected node is not available, try the rest of the shard */
+  MRConn *conn = _MRClusterShard_GetAlternateConn(cl, sh, strategy, node->id, &node);
+  if (retryCtx_Send(rc, conn, node, 0) == REDIS_OK) {
+    return REDIS_OK;
+  }
+  freeRetryCtx(rc);
+  return REDIS_ERR;
 }
 
 /* Multiplex a command to all coordinators, using a specific coordination strategy. Returns the
@@ -185,6 +460,7 @@ int MRCluster_FanoutCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCo
       it = MRNodeMap_IterateAll(cl->nodeMap);
   }
 
+  int idempotent = MRCommand_GetFlags(cmd) & MRCommand_Idempotent;
   int ret = 0;
   MRClusterNode *n;
   while (NULL != (n = it.Next(&it))) {
@@ -194,12 +470,21 @@ int MRCluster_FanoutCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCo
     MRConn *conn = MRConn_Get(&cl->mgr, n->id);
     // printf("Sending fanout command to %s:%d\n", conn->ep.host, conn->ep.port);
     if (conn) {
-      if (MRConn_SendCommand(conn, cmd, fn, privdata) != REDIS_ERR) {
+      if (idempotent) {
+        MRRetryCtx *rc = newRetryCtx(cl, strategy, cmd, -1, fn, privdata);
+        if (retryCtx_Send(rc, conn, n, 0) != REDIS_ERR) {
+          ret++;
+        } else {
+          freeRetryCtx(rc);
+        }
+      } else if (MRConn_SendCommand(conn, cmd, fn, privdata) != REDIS_ERR) {
         ret++;
       }
     }
   }
-  if(cmd->cmd) {
+  // the serialized form is only kept for idempotent commands, whose retries send it again. It is
+  // freed with the command
+  if (cmd->cmd && !idempotent) {
     sdsfree(cmd->cmd);
     cmd->cmd = NULL;
   }
@@ -214,6 +499,20 @@ int MRCluster_ConnectAll(MRCluster *cl) {
   return MRConnManager_ConnectAll(&cl->mgr);
 }
 
+int MRCluster_IsReady(MRCluster *cl) {
+  if (!cl->topo || !cl->topo->numShards) return 0;
+
+  for (size_t i = 0; i < cl->topo->numShards; i++) {
+    MRClusterShard *sh = &cl->topo->shards[i];
+    int reachable = 0;
+    for (size_t j = 0; j < sh->numNodes && !reachable; j++) {
+      reachable = MRConn_IsConnected(&cl->mgr, sh->nodes[j].id);
+    }
+    if (!reachable) return 0;
+  }
+  return 1;
+}
+
 void MRKey_Parse(MRKey *mk, const char *src, size_t srclen) {
   mk->shard = mk->base = src;
   mk->shardLen = mk->baseLen = srclen;
@@ -269,6 +568,13 @@ mr_slot_t CRC16ShardFunc(MRCommand *cmd, mr_slot_t numSlots) {
   return crc % numSlots;
 }
 
+mr_slot_t CRC16KeyShardFunc(const char *key, size_t len, mr_slot_t numSlots) {
+  MRKey mk;
+  MRKey_Parse(&mk, key, len);
+  uint16_t crc = crc16(mk.shard, mk.shardLen);
+  return crc % numSlots;
+}
+
 mr_slot_t CRC12ShardFunc(MRCommand *cmd, mr_slot_t numSlots) {
   size_t len;
 
@@ -282,6 +588,13 @@ mr_slot_t CRC12ShardFunc(MRCommand *cmd, mr_slot_t numSlots) {
   return crc % numSlots;
 }
 
+mr_slot_t CRC12KeyShardFunc(const char *key, size_t len, mr_slot_t numSlots) {
+  MRKey mk;
+  MRKey_Parse(&mk, key, len);
+  uint16_t crc = crc12(mk.shard, mk.shardLen);
+  return crc % numSlots;
+}
+
 void MRClusterTopology_Free(MRClusterTopology *t) {
   for (int s = 0; s < t->numShards; s++) {
     for (int n = 0; n < t->shards[s].numNodes; n++) {
@@ -306,6 +619,120 @@ int MRClusterTopology_IsValid(MRClusterTopology *t) {
   return sum >= t->numSlots;
 }
 
+/* The version of the serialized topology format, bumped on incompatible changes */
+#define MRTOPOLOGY_SERIALIZE_VERSION 1
+
+sds MRClusterTopology_Serialize(MRClusterTopology *t) {
+  sds s = sdscatprintf(sdsempty(), "MRTOPOLOGY %d %zu %d %zu\n", MRTOPOLOGY_SERIALIZE_VERSION,
+                       t->numSlots, (int)t->hashFunc, t->numShards);
+  for (size_t i = 0; i < t->numShards; i++) {
+    MRClusterShard *sh = &t->shards[i];
+    s = sdscatprintf(s, "SHARD %d %d %zu\n", sh->startSlot, sh->endSlot, sh->numNodes);
+    for (size_t j = 0; j < sh->numNodes; j++) {
+      MRClusterNode *n = &sh->nodes[j];
+      // strings are quoted so they can be read back with sdssplitargs
+      s = sdscat(s, "NODE ");
+      s = sdscatrepr(s, n->id, strlen(n->id));
+      s = sdscat(s, " ");
+      s = sdscatrepr(s, n->endpoint.host, strlen(n->endpoint.host));
+      s = sdscatprintf(s, " %d %d ", n->endpoint.port, (int)n->flags);
+      // optional strings are written as empty strings
+      const char *auth = n->endpoint.auth ? n->endpoint.auth : "";
+      const char *sock = n->endpoint.unixSock ? n->endpoint.unixSock : "";
+      s = sdscatrepr(s, auth, strlen(auth));
+      s = sdscat(s, " ");
+      s = sdscatrepr(s, sock, strlen(sock));
+      s = sdscat(s, "\n");
+    }
+  }
+  return s;
+}
+
+static int parseSize(const char *s, long long max, long long *out) {
+  char *end;
+  long long ll = strtoll(s, &end, 10);
+  if (!*s || *end || ll < 0 || ll > max) return 0;
+  *out = ll;
+  return 1;
+}
+
+MRClusterTopology *MRClusterTopology_Deserialize(const char *buf, size_t len) {
+  int nlines = 0;
+  sds *lines = sdssplitlen(buf, len, "\n", 1, &nlines);
+  if (!lines) return NULL;
+
+  MRClusterTopology *topo = NULL;
+  MRClusterShard *sh = NULL;
+  size_t expectedNodes = 0;
+  long long numShards = 0, hashFunc, numSlots, version;
+  int ok = 1;
+
+  for (int l = 0; l < nlines && ok; l++) {
+    if (sdslen(lines[l]) == 0) continue;
+    int argc = 0;
+    sds *argv = sdssplitargs(lines[l], &argc);
+    if (!argv || argc == 0) {
+      ok = argv != NULL;
+      if (argv) sdsfreesplitres(argv, argc);
+      continue;
+    }
+
+    if (!topo) {
+      // the header line must come first
+      ok = argc == 5 && !strcmp(argv[0], "MRTOPOLOGY") &&
+           parseSize(argv[1], INT32_MAX, &version) && version == MRTOPOLOGY_SERIALIZE_VERSION &&
+           parseSize(argv[2], UINT16_MAX + 1, &numSlots) &&
+           parseSize(argv[3], MRHashFunc_CRC16, &hashFunc) &&
+           parseSize(argv[4], UINT16_MAX + 1, &numShards);
+      if (ok) {
+        topo = MR_NewTopology(numShards, numSlots);
+        topo->hashFunc = hashFunc;
+      }
+    } else if (!strcmp(argv[0], "SHARD")) {
+      long long start, end, numNodes;
+      ok = argc == 4 && (!sh || sh->numNodes == expectedNodes) &&
+           topo->numShards < (size_t)numShards && parseSize(argv[1], UINT16_MAX, &start) &&
+           parseSize(argv[2], UINT16_MAX, &end) && parseSize(argv[3], UINT16_MAX, &numNodes) &&
+           start <= end;
+      if (ok) {
+        MRClusterShard newsh = MR_NewClusterShard(start, end, numNodes);
+        MRClusterTopology_AddShard(topo, &newsh);
+        sh = &topo->shards[topo->numShards - 1];
+        expectedNodes = numNodes;
+      }
+    } else if (!strcmp(argv[0], "NODE")) {
+      long long port, flags;
+      ok = argc == 7 && sh && sh->numNodes < expectedNodes && parseSize(argv[3], 65535, &port) &&
+           parseSize(argv[4], INT32_MAX, &flags);
+      if (ok) {
+        MRClusterNode node = {
+            .endpoint =
+                {
+                    .host = strdup(argv[2]),
+                    .port = port,
+                    .auth = sdslen(argv[5]) ? strdup(argv[5]) : NULL,
+                    .unixSock = sdslen(argv[6]) ? strdup(argv[6]) : NULL,
+                },
+            .id = strdup(argv[1]),
+            .flags = flags,
+        };
+        MRClusterShard_AddNode(sh, &node);
+      }
+    } else {
+      ok = 0;
+    }
+    sdsfreesplitres(argv, argc);
+  }
+  sdsfreesplitres(lines, nlines);
+
+  if (topo && (!ok || topo->numShards != (size_t)numShards ||
+               (sh && sh->numNodes != expectedNodes))) {
+    MRClusterTopology_Free(topo);
+    return NULL;
+  }
+  return topo;
+}
+
 size_t MRCluster_NumShards(MRCluster *cl) {
   if (cl->topo) {
     return cl->topo->numShards;
@@ -343,10 +770,17 @@ int MRCLuster_UpdateTopology(MRCluster *cl, MRClusterTopology *newTopo) {
   // if the topology has updated, we update to the new one
   if (newTopo->hashFunc != MRHashFunc_None) {
     cl->sf = selectHashFunc(newTopo->hashFunc);
+    cl->ksf = keyShardFunc(cl->sf);
   } else if (cl->topo) {
     newTopo->hashFunc = cl->topo->hashFunc;
   }
 
+  // slot redirections are relative to the old topology and point into it
+  if (cl->movedSlots) {
+    free(cl->movedSlots);
+    cl->movedSlots = NULL;
+  }
+
   MRClusterTopology *old = cl->topo;
   cl->topo = newTopo;
   if (cl->topo) {
@@ -8,6 +8,7 @@
 #include "endpoint.h"
 #include "command.h"
 #include "node.h"
+#include "reply.h"
 
 typedef uint16_t mr_slot_t;
 
@@ -58,10 +59,21 @@ void MRClusterNode_Free(MRClusterNode *n);
  * slot coverage is complete */
 int MRClusterTopology_IsValid(MRClusterTopology *t);
 
+/* Serialize the topology into a new sds string, which can be persisted and later loaded with
+ * MRClusterTopology_Deserialize */
+sds MRClusterTopology_Serialize(MRClusterTopology *t);
+
+/* Load a topology serialized with MRClusterTopology_Serialize. Returns NULL if the input is
+ * malformed */
+MRClusterTopology *MRClusterTopology_Deserialize(const char *buf, size_t len);
+
 /* A function that tells the cluster which shard to send a command to. should return -1 if not
  * applicable */
 typedef mr_slot_t (*ShardFunc)(MRCommand *cmd, mr_slot_t numSlots);
 
+/* The hash of a ShardFunc, applied to a key rather than to a command */
+typedef mr_slot_t (*KeyShardFunc)(const char *key, size_t len, mr_slot_t numSlots);
+
 /* A cluster has nodes and connections that can be used by the engine to send requests */
 typedef struct {
   /* The connection manager holds a connection to each node, indexed by node id */
@@ -73,10 +85,16 @@ typedef struct {
   MRClusterShard *myshard;
   /* The sharding functino, responsible for transforming keys into slots */
   ShardFunc sf;
+  /* The same hash as sf, for looking up the slot of a key without building a command */
+  KeyShardFunc ksf;
 
   /* map of nodes by ip:port */
   MRNodeMap *nodeMap;
 
+  /* Slots we got a MOVED redirection for since the last topology update, indexed by slot. Each
+   * entry points to the node the slot has moved to, or is NULL if the slot was not redirected */
+  MRClusterNode **movedSlots;
+
   // the time we last updated the topology
   // TODO: use millisecond precision time here
   time_t lastTopologyUpdate;
@@ -99,16 +117,26 @@ typedef enum {
 } MRCoordinationStrategy;
 
 /* Multiplex a non-sharding command to all coordinators, using a specific coordination strategy. The
- * return value is the number of nodes we managed to successfully send the command to */
+ * return value is the number of nodes we managed to successfully send the command to.
+ * Idempotent commands are retried the same way as in MRCluster_SendCommand */
 int MRCluster_FanoutCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCommand *cmd,
                             redisCallbackFn *fn, void *privdata);
 
 /* Send a command to its approrpriate shard, selecting a node based on the coordination strategy.
  * Returns REDIS_OK on success, REDIS_ERR on failure. Notice that that send is asynchronous so even
- * thuogh we signal for success, the request may fail */
+ * thuogh we signal for success, the request may fail.
+ * Idempotent commands are transparently re-sent (up to MRCLUSTER_MAX_RETRIES times) on MOVED/ASK
+ * redirections, TRYAGAIN/CLUSTERDOWN errors and connection loss, and the callback only gets the
+ * final reply. The command must stay valid until then */
 int MRCluster_SendCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCommand *cmd,
                           redisCallbackFn *fn, void *privdata);
 
+/* Find the shard a key is stored on, and the slot it hashes to. Used to route a command by a key
+ * other than its sharding key, by setting its targetSlot. Returns NULL if no shard serves the
+ * slot */
+MRClusterShard *MRCluster_ShardForKey(MRCluster *cl, const char *key, size_t len,
+                                      mr_slot_t *slot);
+
 /* The number of individual hosts (by IP adress) in the cluster */
 size_t MRCluster_NumHosts(MRCluster *cl);
 
@@ -122,6 +150,10 @@ size_t MRCluster_NumShards(MRCluster *cl);
  * started */
 int MRCluster_ConnectAll(MRCluster *cl);
 
+/* Return 1 if every shard in the topology has at least one connected node, i.e. all partitions
+ * are reachable */
+int MRCluster_IsReady(MRCluster *cl);
+
 /* Create a new cluster using a node provider */
 MRCluster *MR_NewCluster(MRClusterTopology *topology, ShardFunc sharder,
                          long long minTopologyUpdateInterval);
@@ -132,6 +164,33 @@ int MRCLuster_UpdateTopology(MRCluster *cl, MRClusterTopology *newTopology);
 
 mr_slot_t CRC16ShardFunc(MRCommand *cmd, mr_slot_t numSlots);
 mr_slot_t CRC12ShardFunc(MRCommand *cmd, mr_slot_t numSlots);
+mr_slot_t CRC16KeyShardFunc(const char *key, size_t len, mr_slot_t numSlots);
+mr_slot_t CRC12KeyShardFunc(const char *key, size_t len, mr_slot_t numSlots);
+
+/* The maximal number of times an idempotent command is re-sent before its error is returned */
+#define MRCLUSTER_MAX_RETRIES 3
+
+/* Parse a MOVED or ASK error reply ("MOVED <slot> <host>:<port>"). Returns 1 and sets the slot and
+ * the node address (pointing into the reply) if the reply is a redirection, 0 otherwise */
+int MRCluster_ParseRedirect(MRReply *r, int *isAsk, mr_slot_t *slot, const char **addr,
+                            size_t *addrLen);
+
+/* How a reply to an idempotent command is handled */
+typedef enum {
+  /* Passed on to the caller */
+  MRReply_Final,
+  /* Re-sent to the node in the redirection */
+  MRReply_Moved,
+  MRReply_Ask,
+  /* Re-sent after a backoff, on TRYAGAIN and CLUSTERDOWN */
+  MRReply_TryAgain,
+  /* Re-sent to another node of the shard */
+  MRReply_ConnLost,
+} MRReplyRetryType;
+
+/* Classify a reply to an idempotent command that was re-sent `attempts` times already. A NULL
+ * reply means the connection was lost. Once the retries are used up every reply is final */
+MRReplyRetryType MRCluster_RetryType(MRReply *r, int attempts);
 
 typedef struct {
   const char *base;
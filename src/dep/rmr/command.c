@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
 #include "../../version.h"
 
 /*
@@ -20,14 +21,21 @@ struct mrCommandConf {
 struct mrCommandConf __commandConfig[] = {
 
     // document commands
-    {"_FT.SEARCH", MRCommand_Read | MRCommand_SingleKey | MRCommand_Aliased, 1, 1, NULL},
+    {"_FT.SEARCH",
+     MRCommand_Read | MRCommand_Idempotent | MRCommand_LazyReply | MRCommand_SingleKey |
+         MRCommand_Aliased,
+     1, 1, NULL},
     {"_FT.DEL", MRCommand_Write | MRCommand_MultiKey | MRCommand_Aliased, 2, 2, NULL},
     {"_FT.GET", MRCommand_Read | MRCommand_MultiKey | MRCommand_Aliased, 2, 2, NULL},
-    {"_FT.MGET", MRCommand_Read | MRCommand_MultiKey | MRCommand_Aliased, 1, 2, NULL},
+    {"_FT.MGET",
+     MRCommand_Read | MRCommand_Idempotent | MRCommand_LazyReply | MRCommand_MultiKey |
+         MRCommand_Aliased,
+     1, 2, NULL},
 
     {"_FT.ADD", MRCommand_Write | MRCommand_MultiKey | MRCommand_Aliased, 2, 2, NULL},
     {"_FT.ADDHASH", MRCommand_Write | MRCommand_MultiKey | MRCommand_Aliased, 2, 2, NULL},
-    {"_FT.AGGREGATE", MRCommand_Read | MRCommand_SingleKey | MRCommand_Aliased, 1, 1, NULL},
+    {"_FT.AGGREGATE",
+     MRCommand_Read | MRCommand_Idempotent | MRCommand_SingleKey | MRCommand_Aliased, 1, 1, NULL},
 
     // index commands
     {"_FT.CREATE", MRCommand_Write | MRCommand_SingleKey, 1, 1, NULL},
@@ -37,7 +45,10 @@ struct mrCommandConf __commandConfig[] = {
     {"_FT.DROP", MRCommand_Write | MRCommand_SingleKey | MRCommand_Aliased, 1, 1, NULL},
     {"_FT.DELETE", MRCommand_Write | MRCommand_SingleKey | MRCommand_Aliased, 1, 1, NULL},
     {"_FT.OPTIMIZE", MRCommand_Write | MRCommand_SingleKey | MRCommand_Aliased, 1, 1, NULL},
-    {"_FT.INFO", MRCommand_Read | MRCommand_SingleKey | MRCommand_Aliased, 1, 1, NULL},
+    {"_FT.INFO",
+     MRCommand_Read | MRCommand_Idempotent | MRCommand_LazyReply | MRCommand_SingleKey |
+         MRCommand_Aliased,
+     1, 1, NULL},
     {"_FT.EXPLAIN", MRCommand_Read | MRCommand_SingleKey | MRCommand_Aliased, 1, 1, NULL},
     {"_FT.TAGVALS", MRCommand_Read | MRCommand_SingleKey | MRCommand_Aliased, 1, 1, NULL},
 
@@ -55,7 +66,7 @@ struct mrCommandConf __commandConfig[] = {
 
     // Synonyms commands
     {"_FT.SYNADD", MRCommand_Write | MRCommand_NoKey, 1, -1, NULL},
-    {"_FT.SYNDUMP", MRCommand_Write | MRCommand_NoKey, 1, -1, NULL},
+    {"_FT.SYNDUMP", MRCommand_Write | MRCommand_NoKey | MRCommand_LazyReply, 1, -1, NULL},
     {"_FT.SYNUPDATE", MRCommand_Write | MRCommand_NoKey, 1, -1, NULL},
     {"_FT.SYNFORCEUPDATE", MRCommand_Write | MRCommand_NoKey, 1, -1, NULL},
 
@@ -102,20 +113,101 @@ struct mrCommandConf __commandConfig[] = {
     {NULL},
 };
 
+/* Case insensitive index of __commandConfig, built once on first use. Entries are sorted by name,
+ * and by position for duplicate names so the first configuration of a name wins */
+static int *confIndex_g = NULL;
+static int confIndexLen_g = 0;
+/* The id of the internal command of each configuration (FT.X -> _FT.X), or -1 if it has none */
+static int *internalConfId_g = NULL;
+static pthread_once_t confIndexOnce_g = PTHREAD_ONCE_INIT;
+
+static int confIndexCmp(const void *a, const void *b) {
+  int ia = *(const int *)a, ib = *(const int *)b;
+  int rc = strcasecmp(__commandConfig[ia].command, __commandConfig[ib].command);
+  return rc ? rc : ia - ib;
+}
+
+static int lookupConfId(const char *name) {
+  int lo = 0, hi = confIndexLen_g;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (strcasecmp(__commandConfig[confIndex_g[mid]].command, name) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < confIndexLen_g && !strcasecmp(__commandConfig[confIndex_g[lo]].command, name)) {
+    return confIndex_g[lo];
+  }
+  return -1;
+}
+
+static void buildConfIndex(void) {
+  int n = 0;
+  while (__commandConfig[n].command != NULL) n++;
+
+  confIndex_g = malloc(n * sizeof(*confIndex_g));
+  for (int i = 0; i < n; i++) {
+    confIndex_g[i] = i;
+  }
+  qsort(confIndex_g, n, sizeof(*confIndex_g), confIndexCmp);
+  confIndexLen_g = n;
+
+  internalConfId_g = malloc(n * sizeof(*internalConfId_g));
+  for (int i = 0; i < n; i++) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "_%s", __commandConfig[i].command);
+    internalConfId_g[i] = lookupConfId(buf);
+  }
+}
+
+static inline void ensureConfIndex(void) {
+  pthread_once(&confIndexOnce_g, buildConfIndex);
+}
+
 int _getCommandConfId(MRCommand *cmd) {
   cmd->id = -1;
   if (cmd->num == 0) {
     return 0;
   }
 
-  for (int i = 0; __commandConfig[i].command != NULL; i++) {
-    if (!strcasecmp(cmd->strs[0], __commandConfig[i].command)) {
-      // printf("conf id for cmd %s: %d\n", cmd->strs[0], i);
-      cmd->id = i;
-      return 1;
-    }
+  ensureConfIndex();
+  cmd->id = lookupConfId(cmd->strs[0]);
+  return cmd->id >= 0;
+}
+
+/* Argument storage owned by a command. Chunks are chained and never moved, so arguments already
+ * pointing into the arena stay valid when more are added */
+typedef struct MRCommandArena {
+  struct MRCommandArena *next;
+  size_t used;
+  size_t cap;
+  char data[];
+} MRCommandArena;
+
+#define MRCOMMAND_ARENA_MIN_CHUNK 256
+/* Room for a few injected arguments (LIMIT, WITHSCORES, ...) without reallocating the arrays */
+#define MRCOMMAND_SPARE_ARGS 4
+
+static void arenaReserve(MRCommand *cmd, size_t n) {
+  MRCommandArena *a = cmd->arena;
+  if (a && a->cap - a->used >= n) {
+    return;
   }
-  return 0;
+  size_t cap = n > MRCOMMAND_ARENA_MIN_CHUNK ? n : MRCOMMAND_ARENA_MIN_CHUNK;
+  a = malloc(sizeof(*a) + cap);
+  a->next = cmd->arena;
+  a->used = 0;
+  a->cap = cap;
+  cmd->arena = a;
+}
+
+static char *arenaAlloc(MRCommand *cmd, size_t n) {
+  arenaReserve(cmd, n);
+  char *p = cmd->arena->data + cmd->arena->used;
+  cmd->arena->used += n;
+  return p;
 }
 
 void MRCommand_Free(MRCommand *cmd) {
@@ -123,16 +215,26 @@ void MRCommand_Free(MRCommand *cmd) {
     sdsfree(cmd->cmd);
   }
   for (int i = 0; i < cmd->num; i++) {
-    free(cmd->strs[i]);
+    if (cmd->argFlags[i] & MRCommandArg_Owned) {
+      free(cmd->strs[i]);
+    }
+  }
+  while (cmd->arena) {
+    MRCommandArena *next = cmd->arena->next;
+    free(cmd->arena);
+    cmd->arena = next;
   }
   free(cmd->strs);
   free(cmd->lens);
+  free(cmd->argFlags);
 }
 
+/* Copy an argument into the command's arena */
 static void assignStr(MRCommand *cmd, size_t idx, const char *s, size_t n) {
-  char *news = malloc(n + 1);
+  char *news = arenaAlloc(cmd, n + 1);
   cmd->strs[idx] = news;
   cmd->lens[idx] = n;
+  cmd->argFlags[idx] = 0;
   news[n] = 0;
   memcpy(news, s, n);
 }
@@ -154,10 +256,28 @@ static void assignRstr(MRCommand *dst, size_t idx, RedisModuleString *src) {
   assignStr(dst, idx, s, n);
 }
 
+/* Release an argument before it is overwritten. Arena and borrowed arguments are left alone */
+static void releaseArg(MRCommand *cmd, size_t idx) {
+  if (cmd->argFlags[idx] & MRCommandArg_Owned) {
+    free(cmd->strs[idx]);
+  }
+}
+
+/* Drop the cached serialized form of the command, after its arguments have changed */
+static void invalidateSerialized(MRCommand *cmd) {
+  if (cmd->cmd) {
+    sdsfree(cmd->cmd);
+    cmd->cmd = NULL;
+  }
+}
+
 static void MRCommand_Init(MRCommand *cmd, size_t len) {
   cmd->num = len;
-  cmd->strs = malloc(sizeof(*cmd->strs) * len);
-  cmd->lens = malloc(sizeof(*cmd->lens) * len);
+  cmd->cap = len + MRCOMMAND_SPARE_ARGS;
+  cmd->strs = malloc(sizeof(*cmd->strs) * cmd->cap);
+  cmd->lens = malloc(sizeof(*cmd->lens) * cmd->cap);
+  cmd->argFlags = calloc(cmd->cap, sizeof(*cmd->argFlags));
+  cmd->arena = NULL;
   cmd->id = 0;
   cmd->targetSlot = -1;
   cmd->cmd = NULL;
@@ -180,6 +300,12 @@ MRCommand MRCommand_Copy(const MRCommand *cmd) {
   MRCommand_Init(&ret, cmd->num);
   ret.id = cmd->id;
 
+  // copy all the arguments into a single arena chunk
+  size_t total = 0;
+  for (int i = 0; i < cmd->num; i++) {
+    total += cmd->lens[i] + 1;
+  }
+  arenaReserve(&ret, total);
   for (int i = 0; i < cmd->num; i++) {
     copyStr(&ret, i, cmd, i);
   }
@@ -213,6 +339,13 @@ MRCommand MR_NewCommandFromStrings(int argc, char **argv) {
 MRCommand MR_NewCommandFromRedisStrings(int argc, RedisModuleString **argv) {
   MRCommand cmd;
   MRCommand_Init(&cmd, argc);
+  size_t total = 0;
+  for (int i = 0; i < argc; i++) {
+    size_t n;
+    RedisModule_StringPtrLen(argv[i], &n);
+    total += n + 1;
+  }
+  arenaReserve(&cmd, total);
   for (int i = 0; i < argc; i++) {
     assignRstr(&cmd, i, argv[i]);
   }
@@ -220,10 +353,46 @@ MRCommand MR_NewCommandFromRedisStrings(int argc, RedisModuleString **argv) {
   return cmd;
 }
 
+MRCommand MR_NewCommandBorrowingStrings(int argc, RedisModuleString **argv) {
+  MRCommand cmd;
+  MRCommand_Init(&cmd, argc);
+  for (int i = 0; i < argc; i++) {
+    // redis strings are null terminated, so they can be used as is
+    cmd.strs[i] = (char *)RedisModule_StringPtrLen(argv[i], &cmd.lens[i]);
+    cmd.argFlags[i] = MRCommandArg_Borrowed;
+  }
+  _getCommandConfId(&cmd);
+  return cmd;
+}
+
+void MRCommand_CopyBorrowed(MRCommand *cmd) {
+  size_t total = 0;
+  for (int i = 0; i < cmd->num; i++) {
+    if (cmd->argFlags[i] & MRCommandArg_Borrowed) {
+      total += cmd->lens[i] + 1;
+    }
+  }
+  if (!total) {
+    return;
+  }
+  arenaReserve(cmd, total);
+  for (int i = 0; i < cmd->num; i++) {
+    if (cmd->argFlags[i] & MRCommandArg_Borrowed) {
+      assignStr(cmd, i, cmd->strs[i], cmd->lens[i]);
+    }
+  }
+}
+
 static void extendCommandList(MRCommand *cmd, size_t toAdd) {
+  invalidateSerialized(cmd);
   cmd->num += toAdd;
-  cmd->strs = realloc(cmd->strs, sizeof(*cmd->strs) * cmd->num);
-  cmd->lens = realloc(cmd->lens, sizeof(*cmd->lens) * cmd->num);
+  if (cmd->num <= cmd->cap) {
+    return;
+  }
+  cmd->cap = cmd->num + MRCOMMAND_SPARE_ARGS;
+  cmd->strs = realloc(cmd->strs, sizeof(*cmd->strs) * cmd->cap);
+  cmd->lens = realloc(cmd->lens, sizeof(*cmd->lens) * cmd->cap);
+  cmd->argFlags = realloc(cmd->argFlags, sizeof(*cmd->argFlags) * cmd->cap);
 }
 
 void MRCommand_AppendStringsArgs(MRCommand *cmd, int num, char **args) {
@@ -244,6 +413,7 @@ void MRCommand_AppendArgsAtPos(MRCommand *cmd, int pos, int num, ...) {
   // shift right all arguments that comes after pos
   memmove(cmd->strs + pos + num, cmd->strs + pos, (oldNum - pos) * sizeof(char*));
   memmove(cmd->lens + pos + num, cmd->lens + pos, (oldNum - pos) * sizeof(size_t));
+  memmove(cmd->argFlags + pos + num, cmd->argFlags + pos, (oldNum - pos) * sizeof(uint8_t));
 
   va_list(ap);
   va_start(ap, num);
@@ -253,6 +423,21 @@ void MRCommand_AppendArgsAtPos(MRCommand *cmd, int pos, int num, ...) {
   va_end(ap);
 }
 
+void MRCommand_RemoveArgs(MRCommand *cmd, int index, int num) {
+  if (num <= 0 || index < 0 || index + num > cmd->num) return;
+  invalidateSerialized(cmd);
+  for (int i = index; i < index + num; i++) {
+    releaseArg(cmd, i);
+  }
+
+  // shift left all arguments that come after the removed ones
+  int rest = cmd->num - index - num;
+  memmove(cmd->strs + index, cmd->strs + index + num, rest * sizeof(char *));
+  memmove(cmd->lens + index, cmd->lens + index + num, rest * sizeof(size_t));
+  memmove(cmd->argFlags + index, cmd->argFlags + index + num, rest * sizeof(uint8_t));
+  cmd->num -= num;
+}
+
 void MRCommand_AppendArgs(MRCommand *cmd, int num, ...) {
   if (num <= 0) return;
   int oldNum = cmd->num;
@@ -278,6 +463,14 @@ void MRCommand_Append(MRCommand *cmd, const char *s, size_t n) {
   }
 }
 
+static void replaceArgNoDup(MRCommand *cmd, int index, const char *newArg, size_t len) {
+  invalidateSerialized(cmd);
+  releaseArg(cmd, index);
+  cmd->strs[index] = (char *)newArg;
+  cmd->lens[index] = len;
+  cmd->argFlags[index] = MRCommandArg_Owned;
+}
+
 /** Set the prefix of the command (i.e {prefix}.{command}) to a given prefix. If the command has a
  * module style prefx it gets replaced with the new prefix. If it doesn't, we prepend the prefix to
  * the command. */
@@ -290,20 +483,28 @@ void MRCommand_SetPrefix(MRCommand *cmd, const char *newPrefix) {
     suffix++;
   }
 
+  // rewriting a coordination command to its internal command maps directly to the target id
+  int id = -1;
+  if (cmd->id >= 0 && !strcasecmp(newPrefix, "_FT") && !strncasecmp(cmd->strs[0], "FT.", 3)) {
+    ensureConfIndex();
+    id = internalConfId_g[cmd->id];
+  }
+
   char *buf = NULL;
   asprintf(&buf, "%s.%s", newPrefix, suffix);
-  MRCommand_ReplaceArgNoDup(cmd, 0, buf, strlen(buf));
-  _getCommandConfId(cmd);
+  replaceArgNoDup(cmd, 0, buf, strlen(buf));
+  if (id >= 0) {
+    cmd->id = id;
+  } else {
+    _getCommandConfId(cmd);
+  }
 }
 
 void MRCommand_ReplaceArgNoDup(MRCommand *cmd, int index, const char *newArg, size_t len) {
   if (index < 0 || index >= cmd->num) {
     return;
   }
-  char *tmp = cmd->strs[index];
-  cmd->strs[index] = (char *)newArg;
-  cmd->lens[index] = len;
-  free(tmp);
+  replaceArgNoDup(cmd, index, newArg, len);
 
   // if we've replaced the first argument, we need to reconfigure the command
   if (index == 0) {
@@ -311,10 +512,17 @@ void MRCommand_ReplaceArgNoDup(MRCommand *cmd, int index, const char *newArg, si
   }
 }
 void MRCommand_ReplaceArg(MRCommand *cmd, int index, const char *newArg, size_t len) {
-  char *news = malloc(len + 1);
-  news[len] = 0;
-  memcpy(news, newArg, len);
-  MRCommand_ReplaceArgNoDup(cmd, index, news, len);
+  if (index < 0 || index >= cmd->num) {
+    return;
+  }
+  invalidateSerialized(cmd);
+  releaseArg(cmd, index);
+  assignStr(cmd, index, newArg, len);
+
+  // if we've replaced the first argument, we need to reconfigure the command
+  if (index == 0) {
+    _getCommandConfId(cmd);
+  }
 }
 
 MRCommandFlags MRCommand_GetFlags(MRCommand *cmd) {
@@ -364,3 +572,36 @@ void MRCommand_FPrint(FILE *fd, MRCommand *cmd) {
   }
   fprintf(fd, "\n");
 }
+
+/* Append a single RESP bulk string */
+static sds catBulk(sds s, const char *arg, size_t len) {
+  s = sdscatfmt(s, "$%U\r\n", (unsigned long long)len);
+  s = sdscatlen(s, arg, len);
+  return sdscatlen(s, "\r\n", 2);
+}
+
+void MRCommandTemplate_Init(MRCommandTemplate *t, const MRCommand *cmd, int argIdx) {
+  t->argIdx = argIdx;
+  t->prefix = sdscatfmt(sdsempty(), "*%u\r\n", (unsigned)cmd->num);
+  for (int i = 0; i < argIdx && i < cmd->num; i++) {
+    t->prefix = catBulk(t->prefix, cmd->strs[i], cmd->lens[i]);
+  }
+  t->suffix = sdsempty();
+  for (int i = argIdx + 1; i < cmd->num; i++) {
+    t->suffix = catBulk(t->suffix, cmd->strs[i], cmd->lens[i]);
+  }
+}
+
+sds MRCommandTemplate_Format(const MRCommandTemplate *t, const char *arg, size_t len) {
+  // 32 bytes are more than enough for the bulk header and trailer of the patched argument
+  sds s = sdsMakeRoomFor(sdsempty(), sdslen(t->prefix) + len + 32 + sdslen(t->suffix));
+  s = sdscatlen(s, t->prefix, sdslen(t->prefix));
+  s = catBulk(s, arg, len);
+  return sdscatlen(s, t->suffix, sdslen(t->suffix));
+}
+
+void MRCommandTemplate_Free(MRCommandTemplate *t) {
+  sdsfree(t->prefix);
+  sdsfree(t->suffix);
+  t->prefix = t->suffix = NULL;
+}
@@ -3,14 +3,33 @@
 #include <redismodule.h>
 #include "hiredis/sds.h"
 #include <assert.h>
+/* Ownership flags of a single command argument */
+typedef enum {
+  /* The argument was allocated on its own and is freed with the command. Arguments without this
+   * flag or MRCommandArg_Borrowed are in the command's arena */
+  MRCommandArg_Owned = 0x01,
+  /* The argument points into a redis string the command doesn't own, see
+   * MR_NewCommandBorrowingStrings */
+  MRCommandArg_Borrowed = 0x02,
+} MRCommandArgFlags;
+
+struct MRCommandArena;
+
 /* A redis command is represented with all its arguments and its flags as MRCommand */
 typedef struct {
   /* The command args starting from the command itself */
   char **strs;
   size_t *lens;
+  /* Per argument MRCommandArgFlags */
+  uint8_t *argFlags;
 
   /* Number of arguments */
   uint32_t num;
+  /* Allocated capacity of the argument arrays */
+  uint32_t cap;
+
+  /* Storage for arguments copied into the command, freed as a whole with the command */
+  struct MRCommandArena *arena;
 
   /* Internal id used to get the command configuration */
   int id;
@@ -33,6 +52,14 @@ MRCommand MR_NewCommand(int argc, ...);
 MRCommand MR_NewCommandFromStrings(int argc, char **argv);
 /* Create a command from a list of redis strings */
 MRCommand MR_NewCommandFromRedisStrings(int argc, RedisModuleString **argv);
+/* Create a command whose arguments point into a list of redis strings instead of copying them.
+ * The strings must outlive the command, or MRCommand_CopyBorrowed must be called before they are
+ * released, e.g. before the command is handed over to the event loop */
+MRCommand MR_NewCommandBorrowingStrings(int argc, RedisModuleString **argv);
+
+/* Copy the arguments the command borrows into its arena, so it no longer depends on the strings
+ * it was created from */
+void MRCommand_CopyBorrowed(MRCommand *cmd);
 
 static inline const char *MRCommand_ArgStringPtrLen(const MRCommand *cmd, size_t idx, size_t *len) {
   // assert(idx < cmd->num);
@@ -60,6 +87,8 @@ typedef struct {
 void MRCommand_AppendStringsArgs(MRCommand *cmd, int num, char **args);
 void MRCommand_AppendArgs(MRCommand *cmd, int num, ...);
 void MRCommand_AppendArgsAtPos(MRCommand *cmd, int pos, int num, ...);
+/** Remove num arguments starting at index, shifting the rest of the command left */
+void MRCommand_RemoveArgs(MRCommand *cmd, int index, int num);
 
 /** Copy from an argument of an existing command */
 void MRCommand_AppendFrom(MRCommand *cmd, const MRCommand *srcCmd, size_t srcidx);
@@ -86,7 +115,12 @@ typedef enum {
   MRCommand_Coordination = 0x10,
   MRCommand_NoKey = 0x20,
   // Command can be aliased. Look up the alias and rewrite if possible
-  MRCommand_Aliased = 0x40
+  MRCommand_Aliased = 0x40,
+  // Command has no side effects and can be safely re-sent on redirections or connection loss
+  MRCommand_Idempotent = 0x80,
+  // Nested arrays in the reply are only parsed when accessed (see MRReply_Materialize), and are
+  // relayed to the client straight from their encoded form
+  MRCommand_LazyReply = 0x100
 } MRCommandFlags;
 
 MRCommandFlags MRCommand_GetFlags(MRCommand *cmd);
@@ -100,4 +134,25 @@ void MRCommand_FPrint(FILE *fd, MRCommand *cmd);
 /* Create a copy of a command by duplicating all strings */
 MRCommand MRCommand_Copy(const MRCommand *cmd);
 
+/* A command serialized to RESP once, with a single argument left out. Used to send the same
+ * command to many partitions, where only the partition tagged index name changes between copies */
+typedef struct {
+  /* The array header and all arguments before the patched argument */
+  sds prefix;
+  /* All arguments after the patched argument */
+  sds suffix;
+  /* The index of the patched argument */
+  int argIdx;
+} MRCommandTemplate;
+
+/* Serialize the command into a template, leaving argument argIdx to be filled by
+ * MRCommandTemplate_Format */
+void MRCommandTemplate_Init(MRCommandTemplate *t, const MRCommand *cmd, int argIdx);
+
+/* Return the full serialized command, with arg as the patched argument. The result can be set
+ * as the command's serialized form (cmd->cmd) if its arguments match the template */
+sds MRCommandTemplate_Format(const MRCommandTemplate *t, const char *arg, size_t len);
+
+void MRCommandTemplate_Free(MRCommandTemplate *t);
+
 #endif
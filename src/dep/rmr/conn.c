@@ -2,6 +2,7 @@
 #include "reply.h"
 #include "hiredis/adapters/libuv.h"
 #include "search_cluster.h"
+#include "../../config.h"
 
 #include <uv.h>
 #include <signal.h>
@@ -34,7 +35,9 @@ static redisAsyncContext *detachFromConn(MRConn *conn, int shouldFree) {
 
   redisAsyncContext *ac = conn->conn;
   ac->data = NULL;
+  ac->c.reader->privdata = NULL;
   conn->conn = NULL;
+  MRReplyModeQueue_Clear(&conn->replyModes);
   if (shouldFree) {
     redisAsyncFree(ac);
     return NULL;
@@ -113,6 +116,17 @@ MRConn *MRConn_Get(MRConnManager *mgr, const char *id) {
   return NULL;
 }
 
+/* Check if a node has a connected connection, without moving its round-robin selector */
+int MRConn_IsConnected(MRConnManager *mgr, const char *id) {
+  void *ptr = TrieMap_Find(mgr->map, (char *)id, strlen(id));
+  if (ptr == TRIEMAP_NOTFOUND) return 0;
+  MRConnPool *pool = ptr;
+  for (size_t i = 0; i < pool->num; i++) {
+    if (pool->conns[i]->state == MRConn_Connected) return 1;
+  }
+  return 0;
+}
+
 /* Send a command to the connection */
 int MRConn_SendCommand(MRConn *c, MRCommand *cmd, redisCallbackFn *fn, void *privdata) {
 
@@ -127,7 +141,26 @@ int MRConn_SendCommand(MRConn *c, MRCommand *cmd, redisCallbackFn *fn, void *pri
       return REDIS_ERR;
     }
   }
-  return redisAsyncFormattedCommand(c->conn, fn, privdata, cmd->cmd, sdslen(cmd->cmd));
+  if (redisAsyncFormattedCommand(c->conn, fn, privdata, cmd->cmd, sdslen(cmd->cmd)) ==
+      REDIS_ERR) {
+    return REDIS_ERR;
+  }
+  int mode = (MRCommand_GetFlags(cmd) & MRCommand_LazyReply) ? MRREPLY_MODE_LAZY : 0;
+  if (c->compressReplies) mode |= MRREPLY_MODE_COMPRESSED;
+  MRReplyModeQueue_Push(&c->replyModes, mode);
+  return REDIS_OK;
+}
+
+int MRConn_SendAsking(MRConn *c) {
+  if (c->state != MRConn_Connected) {
+    return REDIS_ERR;
+  }
+  // we do not care about the reply, hiredis frees replies that have no callback
+  if (redisAsyncCommand(c->conn, NULL, NULL, "ASKING") == REDIS_ERR) {
+    return REDIS_ERR;
+  }
+  MRReplyModeQueue_Push(&c->replyModes, 0);
+  return REDIS_OK;
 }
 
 // replace an existing coonnection pool with a new one
@@ -216,6 +249,7 @@ static void MRConn_Stop(MRConn *conn) {
 
 static void freeConn(MRConn *conn) {
   MREndpoint_Free(&conn->ep);
+  MRReplyModeQueue_Free(&conn->replyModes);
   if (conn->timer) {
     if (uv_is_active(conn->timer)) {
       uv_timer_stop(conn->timer);
@@ -310,6 +344,84 @@ activate_timer:
   }
 }
 
+static void MRConn_CompressionCallback(redisAsyncContext *c, void *r, void *privdata) {
+  MRConn *conn = c->data;
+  if (!conn || conn->state == MRConn_Freeing) {
+    // Will be picked up by disconnect callback
+    return;
+  }
+
+  if (c->err || !r) {
+    detachFromConn(conn, !!r);
+    MRConn_SwitchState(conn, MRConn_Connecting);
+    return;
+  }
+
+  /* Shards that don't support compression keep sending plain replies */
+  MRReply *rep = r;
+  if (MRReply_Type(rep) == MR_REPLY_ERROR) {
+    CONN_LOG(conn, "Could not enable reply compression: %s", MRReply_String(rep, NULL));
+  } else {
+    conn->compressReplies = 1;
+  }
+  MRReply_Free(rep);
+
+  MRConn_SwitchState(conn, MRConn_Connected);
+}
+
+/* Ask the shard to compress replies larger than the configured threshold on this connection */
+static int MRConn_SendCompression(MRConn *conn) {
+  if (redisAsyncCommand(conn->conn, MRConn_CompressionCallback, conn,
+                        "_FT.REPLYCOMPRESSION LZ4 %lld",
+                        (long long)clusterConfig.replyCompression) == REDIS_ERR) {
+    return REDIS_ERR;
+  }
+  MRReplyModeQueue_Push(&conn->replyModes, 0);
+  return REDIS_OK;
+}
+
+static void MRConn_HelloCallback(redisAsyncContext *c, void *r, void *privdata) {
+  MRConn *conn = c->data;
+  if (!conn || conn->state == MRConn_Freeing) {
+    // Will be picked up by disconnect callback
+    return;
+  }
+
+  if (c->err || !r) {
+    detachFromConn(conn, !!r);
+    MRConn_SwitchState(conn, MRConn_Connecting);
+    return;
+  }
+
+  /* Shards that don't support HELLO keep talking RESP2 on this connection */
+  MRReply *rep = r;
+  if (MRReply_Type(rep) == MR_REPLY_ERROR) {
+    CONN_LOG(conn, "Could not switch to RESP3: %s", MRReply_String(rep, NULL));
+  }
+  MRReply_Free(rep);
+
+  conn->compressReplies = 0;
+  if (clusterConfig.replyCompression) {
+    if (MRConn_SendCompression(conn) != REDIS_OK) {
+      detachFromConn(conn, 1);
+      MRConn_SwitchState(conn, MRConn_Connecting);
+    }
+    return;
+  }
+
+  /* Success! we are now connected! */
+  MRConn_SwitchState(conn, MRConn_Connected);
+}
+
+/* Negotiate RESP3 on a new connection, so scores and numeric values come back as native doubles */
+static int MRConn_SendHello(MRConn *conn) {
+  if (redisAsyncCommand(conn->conn, MRConn_HelloCallback, conn, "HELLO 3") == REDIS_ERR) {
+    return REDIS_ERR;
+  }
+  MRReplyModeQueue_Push(&conn->replyModes, 0);
+  return REDIS_OK;
+}
+
 static void MRConn_AuthCallback(redisAsyncContext *c, void *r, void *privdata) {
   MRConn *conn = c->data;
   if (!conn || conn->state == MRConn_Freeing) {
@@ -329,14 +441,19 @@ static void MRConn_AuthCallback(redisAsyncContext *c, void *r, void *privdata) {
     size_t len;
     const char* s = MRReply_String(rep, &len);
     CONN_LOG(conn, "Error authenticating: %.*s", (int)len, s);
+    MRReply_Free(rep);
     MRConn_SwitchState(conn, MRConn_ReAuth);
     /*we don't try to reconnect to failed connections */
     return;
   }
 
-  /* Success! we are now connected! */
+  MRReply_Free(rep);
+
   // fprintf(stderr, "Connected and authenticated to %s:%d\n", conn->ep.host, conn->ep.port);
-  MRConn_SwitchState(conn, MRConn_Connected);
+  if (MRConn_SendHello(conn) != REDIS_OK) {
+    detachFromConn(conn, 1);
+    MRConn_SwitchState(conn, MRConn_Connecting);
+  }
 }
 
 static int MRConn_SendAuth(MRConn *conn) {
@@ -348,6 +465,7 @@ static int MRConn_SendAuth(MRConn *conn) {
     MRConn_SwitchState(conn, MRConn_ReAuth);
     return REDIS_ERR;
   } else {
+    MRReplyModeQueue_Push(&conn->replyModes, 0);
     return REDIS_OK;
   }
 }
@@ -407,8 +525,9 @@ static void MRConn_ConnectCallback(const redisAsyncContext *c, int status) {
       detachFromConn(conn, 1);
       MRConn_SwitchState(conn, MRConn_Connecting);
     }
-  } else {
-    MRConn_SwitchState(conn, MRConn_Connected);
+  } else if (MRConn_SendHello(conn) != REDIS_OK) {
+    detachFromConn(conn, 1);
+    MRConn_SwitchState(conn, MRConn_Connecting);
   }
   // fprintf(stderr, "Connected %s:%d...\n", conn->ep.host, conn->ep.port);
 }
@@ -452,6 +571,10 @@ static int MRConn_Connect(MRConn *conn) {
     return REDIS_ERR;
   }
 
+  // build replies in a single arena each, they are freed with MRReply_Free
+  c->c.reader->fn = &MRReply_ArenaFunctions;
+  c->c.reader->privdata = &conn->replyModes;
+
   conn->conn = c;
   conn->conn->data = conn;
   conn->state = MRConn_Connecting;
@@ -6,6 +6,7 @@
 #include "hiredis/async.h"
 #include "endpoint.h"
 #include "command.h"
+#include "reply.h"
 #include "dep/triemap/triemap.h"
 
 #define MR_CONN_POOL_SIZE 1
@@ -52,6 +53,10 @@ typedef struct {
   redisAsyncContext *conn;
   MRConnState state;
   void *timer;
+  /* Parsing mode of each pending reply, in the order the commands were sent */
+  MRReplyModeQueue replyModes;
+  /* The shard agreed to send large replies as compressed frames */
+  int compressReplies;
 } MRConn;
 
 /* A pool indexes connections by the node id */
@@ -65,8 +70,15 @@ void MRConnManager_Init(MRConnManager *mgr, int nodeConns);
 /* Get the connection for a specific node by id, return NULL if this node is not in the pool */
 MRConn *MRConn_Get(MRConnManager *mgr, const char *id);
 
+/* Check if a node has a connected (and authenticated) connection */
+int MRConn_IsConnected(MRConnManager *mgr, const char *id);
+
 int MRConn_SendCommand(MRConn *c, MRCommand *cmd, redisCallbackFn *fn, void *privdata);
 
+/* Send an ASKING command on the connection, so that the next command is accepted by a node that is
+ * importing the command's slot */
+int MRConn_SendAsking(MRConn *c);
+
 /* Add a node to the connection manager */
 int MRConnManager_Add(MRConnManager *m, const char *id, MREndpoint *ep, int connect);
 
@@ -0,0 +1,247 @@
+#include "fast_float.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Eisel-Lemire conversion of w * 10^q to the nearest double, see "Number Parsing at a Gigabyte per
+ * Second" (Lemire, 2021). We only keep the powers of ten a search score or sort key can reasonably
+ * have, everything else goes to strtod */
+#define POW10_MIN -64
+#define POW10_MAX 64
+
+/* 5^q normalized to 128 bits, truncated for q >= 0 and rounded up for q < 0 */
+static const uint64_t pow5_128[][2] = {
+    {0xa87fea27a539e9a5ULL, 0x3f2398d747b36225ULL}, /* 1e-64 */
+    {0xd29fe4b18e88640eULL, 0x8eec7f0d19a03aaeULL}, /* 1e-63 */
+    {0x83a3eeeef9153e89ULL, 0x1953cf68300424adULL}, /* 1e-62 */
+    {0xa48ceaaab75a8e2bULL, 0x5fa8c3423c052dd8ULL}, /* 1e-61 */
+    {0xcdb02555653131b6ULL, 0x3792f412cb06794eULL}, /* 1e-60 */
+    {0x808e17555f3ebf11ULL, 0xe2bbd88bbee40bd1ULL}, /* 1e-59 */
+    {0xa0b19d2ab70e6ed6ULL, 0x5b6aceaeae9d0ec5ULL}, /* 1e-58 */
+    {0xc8de047564d20a8bULL, 0xf245825a5a445276ULL}, /* 1e-57 */
+    {0xfb158592be068d2eULL, 0xeed6e2f0f0d56713ULL}, /* 1e-56 */
+    {0x9ced737bb6c4183dULL, 0x55464dd69685606cULL}, /* 1e-55 */
+    {0xc428d05aa4751e4cULL, 0xaa97e14c3c26b887ULL}, /* 1e-54 */
+    {0xf53304714d9265dfULL, 0xd53dd99f4b3066a9ULL}, /* 1e-53 */
+    {0x993fe2c6d07b7fabULL, 0xe546a8038efe402aULL}, /* 1e-52 */
+    {0xbf8fdb78849a5f96ULL, 0xde98520472bdd034ULL}, /* 1e-51 */
+    {0xef73d256a5c0f77cULL, 0x963e66858f6d4441ULL}, /* 1e-50 */
+    {0x95a8637627989aadULL, 0xdde7001379a44aa9ULL}, /* 1e-49 */
+    {0xbb127c53b17ec159ULL, 0x5560c018580d5d53ULL}, /* 1e-48 */
+    {0xe9d71b689dde71afULL, 0xaab8f01e6e10b4a7ULL}, /* 1e-47 */
+    {0x9226712162ab070dULL, 0xcab3961304ca70e9ULL}, /* 1e-46 */
+    {0xb6b00d69bb55c8d1ULL, 0x3d607b97c5fd0d23ULL}, /* 1e-45 */
+    {0xe45c10c42a2b3b05ULL, 0x8cb89a7db77c506bULL}, /* 1e-44 */
+    {0x8eb98a7a9a5b04e3ULL, 0x77f3608e92adb243ULL}, /* 1e-43 */
+    {0xb267ed1940f1c61cULL, 0x55f038b237591ed4ULL}, /* 1e-42 */
+    {0xdf01e85f912e37a3ULL, 0x6b6c46dec52f6689ULL}, /* 1e-41 */
+    {0x8b61313bbabce2c6ULL, 0x2323ac4b3b3da016ULL}, /* 1e-40 */
+    {0xae397d8aa96c1b77ULL, 0xabec975e0a0d081bULL}, /* 1e-39 */
+    {0xd9c7dced53c72255ULL, 0x96e7bd358c904a22ULL}, /* 1e-38 */
+    {0x881cea14545c7575ULL, 0x7e50d64177da2e55ULL}, /* 1e-37 */
+    {0xaa242499697392d2ULL, 0xdde50bd1d5d0b9eaULL}, /* 1e-36 */
+    {0xd4ad2dbfc3d07787ULL, 0x955e4ec64b44e865ULL}, /* 1e-35 */
+    {0x84ec3c97da624ab4ULL, 0xbd5af13bef0b113fULL}, /* 1e-34 */
+    {0xa6274bbdd0fadd61ULL, 0xecb1ad8aeacdd58fULL}, /* 1e-33 */
+    {0xcfb11ead453994baULL, 0x67de18eda5814af3ULL}, /* 1e-32 */
+    {0x81ceb32c4b43fcf4ULL, 0x80eacf948770ced8ULL}, /* 1e-31 */
+    {0xa2425ff75e14fc31ULL, 0xa1258379a94d028eULL}, /* 1e-30 */
+    {0xcad2f7f5359a3b3eULL, 0x096ee45813a04331ULL}, /* 1e-29 */
+    {0xfd87b5f28300ca0dULL, 0x8bca9d6e188853fdULL}, /* 1e-28 */
+    {0x9e74d1b791e07e48ULL, 0x775ea264cf55347eULL}, /* 1e-27 */
+    {0xc612062576589ddaULL, 0x95364afe032a819eULL}, /* 1e-26 */
+    {0xf79687aed3eec551ULL, 0x3a83ddbd83f52205ULL}, /* 1e-25 */
+    {0x9abe14cd44753b52ULL, 0xc4926a9672793543ULL}, /* 1e-24 */
+    {0xc16d9a0095928a27ULL, 0x75b7053c0f178294ULL}, /* 1e-23 */
+    {0xf1c90080baf72cb1ULL, 0x5324c68b12dd6339ULL}, /* 1e-22 */
+    {0x971da05074da7beeULL, 0xd3f6fc16ebca5e04ULL}, /* 1e-21 */
+    {0xbce5086492111aeaULL, 0x88f4bb1ca6bcf585ULL}, /* 1e-20 */
+    {0xec1e4a7db69561a5ULL, 0x2b31e9e3d06c32e6ULL}, /* 1e-19 */
+    {0x9392ee8e921d5d07ULL, 0x3aff322e62439fd0ULL}, /* 1e-18 */
+    {0xb877aa3236a4b449ULL, 0x09befeb9fad487c3ULL}, /* 1e-17 */
+    {0xe69594bec44de15bULL, 0x4c2ebe687989a9b4ULL}, /* 1e-16 */
+    {0x901d7cf73ab0acd9ULL, 0x0f9d37014bf60a11ULL}, /* 1e-15 */
+    {0xb424dc35095cd80fULL, 0x538484c19ef38c95ULL}, /* 1e-14 */
+    {0xe12e13424bb40e13ULL, 0x2865a5f206b06fbaULL}, /* 1e-13 */
+    {0x8cbccc096f5088cbULL, 0xf93f87b7442e45d4ULL}, /* 1e-12 */
+    {0xafebff0bcb24aafeULL, 0xf78f69a51539d749ULL}, /* 1e-11 */
+    {0xdbe6fecebdedd5beULL, 0xb573440e5a884d1cULL}, /* 1e-10 */
+    {0x89705f4136b4a597ULL, 0x31680a88f8953031ULL}, /* 1e-9 */
+    {0xabcc77118461cefcULL, 0xfdc20d2b36ba7c3eULL}, /* 1e-8 */
+    {0xd6bf94d5e57a42bcULL, 0x3d32907604691b4dULL}, /* 1e-7 */
+    {0x8637bd05af6c69b5ULL, 0xa63f9a49c2c1b110ULL}, /* 1e-6 */
+    {0xa7c5ac471b478423ULL, 0x0fcf80dc33721d54ULL}, /* 1e-5 */
+    {0xd1b71758e219652bULL, 0xd3c36113404ea4a9ULL}, /* 1e-4 */
+    {0x83126e978d4fdf3bULL, 0x645a1cac083126eaULL}, /* 1e-3 */
+    {0xa3d70a3d70a3d70aULL, 0x3d70a3d70a3d70a4ULL}, /* 1e-2 */
+    {0xccccccccccccccccULL, 0xcccccccccccccccdULL}, /* 1e-1 */
+    {0x8000000000000000ULL, 0x0000000000000000ULL}, /* 1e0 */
+    {0xa000000000000000ULL, 0x0000000000000000ULL}, /* 1e1 */
+    {0xc800000000000000ULL, 0x0000000000000000ULL}, /* 1e2 */
+    {0xfa00000000000000ULL, 0x0000000000000000ULL}, /* 1e3 */
+    {0x9c40000000000000ULL, 0x0000000000000000ULL}, /* 1e4 */
+    {0xc350000000000000ULL, 0x0000000000000000ULL}, /* 1e5 */
+    {0xf424000000000000ULL, 0x0000000000000000ULL}, /* 1e6 */
+    {0x9896800000000000ULL, 0x0000000000000000ULL}, /* 1e7 */
+    {0xbebc200000000000ULL, 0x0000000000000000ULL}, /* 1e8 */
+    {0xee6b280000000000ULL, 0x0000000000000000ULL}, /* 1e9 */
+    {0x9502f90000000000ULL, 0x0000000000000000ULL}, /* 1e10 */
+    {0xba43b74000000000ULL, 0x0000000000000000ULL}, /* 1e11 */
+    {0xe8d4a51000000000ULL, 0x0000000000000000ULL}, /* 1e12 */
+    {0x9184e72a00000000ULL, 0x0000000000000000ULL}, /* 1e13 */
+    {0xb5e620f480000000ULL, 0x0000000000000000ULL}, /* 1e14 */
+    {0xe35fa931a0000000ULL, 0x0000000000000000ULL}, /* 1e15 */
+    {0x8e1bc9bf04000000ULL, 0x0000000000000000ULL}, /* 1e16 */
+    {0xb1a2bc2ec5000000ULL, 0x0000000000000000ULL}, /* 1e17 */
+    {0xde0b6b3a76400000ULL, 0x0000000000000000ULL}, /* 1e18 */
+    {0x8ac7230489e80000ULL, 0x0000000000000000ULL}, /* 1e19 */
+    {0xad78ebc5ac620000ULL, 0x0000000000000000ULL}, /* 1e20 */
+    {0xd8d726b7177a8000ULL, 0x0000000000000000ULL}, /* 1e21 */
+    {0x878678326eac9000ULL, 0x0000000000000000ULL}, /* 1e22 */
+    {0xa968163f0a57b400ULL, 0x0000000000000000ULL}, /* 1e23 */
+    {0xd3c21bcecceda100ULL, 0x0000000000000000ULL}, /* 1e24 */
+    {0x84595161401484a0ULL, 0x0000000000000000ULL}, /* 1e25 */
+    {0xa56fa5b99019a5c8ULL, 0x0000000000000000ULL}, /* 1e26 */
+    {0xcecb8f27f4200f3aULL, 0x0000000000000000ULL}, /* 1e27 */
+    {0x813f3978f8940984ULL, 0x4000000000000000ULL}, /* 1e28 */
+    {0xa18f07d736b90be5ULL, 0x5000000000000000ULL}, /* 1e29 */
+    {0xc9f2c9cd04674edeULL, 0xa400000000000000ULL}, /* 1e30 */
+    {0xfc6f7c4045812296ULL, 0x4d00000000000000ULL}, /* 1e31 */
+    {0x9dc5ada82b70b59dULL, 0xf020000000000000ULL}, /* 1e32 */
+    {0xc5371912364ce305ULL, 0x6c28000000000000ULL}, /* 1e33 */
+    {0xf684df56c3e01bc6ULL, 0xc732000000000000ULL}, /* 1e34 */
+    {0x9a130b963a6c115cULL, 0x3c7f400000000000ULL}, /* 1e35 */
+    {0xc097ce7bc90715b3ULL, 0x4b9f100000000000ULL}, /* 1e36 */
+    {0xf0bdc21abb48db20ULL, 0x1e86d40000000000ULL}, /* 1e37 */
+    {0x96769950b50d88f4ULL, 0x1314448000000000ULL}, /* 1e38 */
+    {0xbc143fa4e250eb31ULL, 0x17d955a000000000ULL}, /* 1e39 */
+    {0xeb194f8e1ae525fdULL, 0x5dcfab0800000000ULL}, /* 1e40 */
+    {0x92efd1b8d0cf37beULL, 0x5aa1cae500000000ULL}, /* 1e41 */
+    {0xb7abc627050305adULL, 0xf14a3d9e40000000ULL}, /* 1e42 */
+    {0xe596b7b0c643c719ULL, 0x6d9ccd05d0000000ULL}, /* 1e43 */
+    {0x8f7e32ce7bea5c6fULL, 0xe4820023a2000000ULL}, /* 1e44 */
+    {0xb35dbf821ae4f38bULL, 0xdda2802c8a800000ULL}, /* 1e45 */
+    {0xe0352f62a19e306eULL, 0xd50b2037ad200000ULL}, /* 1e46 */
+    {0x8c213d9da502de45ULL, 0x4526f422cc340000ULL}, /* 1e47 */
+    {0xaf298d050e4395d6ULL, 0x9670b12b7f410000ULL}, /* 1e48 */
+    {0xdaf3f04651d47b4cULL, 0x3c0cdd765f114000ULL}, /* 1e49 */
+    {0x88d8762bf324cd0fULL, 0xa5880a69fb6ac800ULL}, /* 1e50 */
+    {0xab0e93b6efee0053ULL, 0x8eea0d047a457a00ULL}, /* 1e51 */
+    {0xd5d238a4abe98068ULL, 0x72a4904598d6d880ULL}, /* 1e52 */
+    {0x85a36366eb71f041ULL, 0x47a6da2b7f864750ULL}, /* 1e53 */
+    {0xa70c3c40a64e6c51ULL, 0x999090b65f67d924ULL}, /* 1e54 */
+    {0xd0cf4b50cfe20765ULL, 0xfff4b4e3f741cf6dULL}, /* 1e55 */
+    {0x82818f1281ed449fULL, 0xbff8f10e7a8921a4ULL}, /* 1e56 */
+    {0xa321f2d7226895c7ULL, 0xaff72d52192b6a0dULL}, /* 1e57 */
+    {0xcbea6f8ceb02bb39ULL, 0x9bf4f8a69f764490ULL}, /* 1e58 */
+    {0xfee50b7025c36a08ULL, 0x02f236d04753d5b4ULL}, /* 1e59 */
+    {0x9f4f2726179a2245ULL, 0x01d762422c946590ULL}, /* 1e60 */
+    {0xc722f0ef9d80aad6ULL, 0x424d3ad2b7b97ef5ULL}, /* 1e61 */
+    {0xf8ebad2b84e0d58bULL, 0xd2e0898765a7deb2ULL}, /* 1e62 */
+    {0x9b934c3b330c8577ULL, 0x63cc55f49f88eb2fULL}, /* 1e63 */
+    {0xc2781f49ffcfa6d5ULL, 0x3cbf6b71c76b25fbULL}, /* 1e64 */
+};
+
+static const double exactPow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline void mul128(uint64_t a, uint64_t b, uint64_t *lo, uint64_t *hi) {
+  __uint128_t r = (__uint128_t)a * b;
+  *lo = (uint64_t)r;
+  *hi = (uint64_t)(r >> 64);
+}
+
+/* Returns 0 if w * 10^q is too close to a rounding boundary to decide with 128 bits of 5^q */
+static int eiselLemire(uint64_t w, long q, int neg, double *d) {
+  const uint64_t *pow5 = pow5_128[q - POW10_MIN];
+  long exponent = (((152170 + 65536) * q) >> 16) + 1024 + 63;
+  int lz = __builtin_clzll(w);
+  w <<= lz;
+
+  uint64_t lo, hi;
+  mul128(w, pow5[0], &lo, &hi);
+  if ((hi & 0x1FF) == 0x1FF && lo + w < lo) {
+    uint64_t lo2, mid;
+    mul128(w, pow5[1], &lo2, &mid);
+    uint64_t sum = lo + mid;
+    if (sum < lo) hi++;
+    if (sum + 1 == 0 && (hi & 0x1FF) == 0x1FF && lo2 + w < lo2) return 0;
+    lo = sum;
+  }
+
+  uint64_t upperbit = hi >> 63;
+  uint64_t mantissa = hi >> (upperbit + 9);
+  lz += (int)(1 ^ upperbit);
+  /* Exactly half way between two doubles: let strtod break the tie */
+  if (lo == 0 && (hi & 0x1FF) == 0 && (mantissa & 3) == 1) return 0;
+
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >= (1ULL << 53)) {
+    mantissa = 1ULL << 52;
+    lz--;
+  }
+  mantissa &= ~(1ULL << 52);
+  long realExponent = exponent - lz;
+  if (realExponent < 1 || realExponent > 2046) return 0;
+
+  uint64_t bits = mantissa | ((uint64_t)realExponent << 52) | ((uint64_t)neg << 63);
+  memcpy(d, &bits, sizeof(*d));
+  return 1;
+}
+
+size_t fast_strtod(const char *str, size_t len, double *d) {
+  const char *p = str, *end = str + len;
+  int neg = 0;
+  if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+  uint64_t w = 0;
+  int significant = 0, anyDigits = 0;
+  long q = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    anyDigits = 1;
+    if (w == 0 && *p == '0') continue;
+    if (++significant > 19) return 0;
+    w = w * 10 + (*p - '0');
+  }
+  if (p < end && *p == '.') {
+    p++;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, q--) {
+      anyDigits = 1;
+      if (w == 0 && *p == '0') continue;
+      if (++significant > 19) return 0;
+      w = w * 10 + (*p - '0');
+    }
+  }
+  if (!anyDigits) return 0;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char *e = p + 1;
+    int eneg = 0;
+    if (e < end && (*e == '-' || *e == '+')) eneg = *e++ == '-';
+    if (e < end && *e >= '0' && *e <= '9') {
+      long exp = 0;
+      for (; e < end && *e >= '0' && *e <= '9'; e++) {
+        if (exp < 100000) exp = exp * 10 + (*e - '0');
+      }
+      q += eneg ? -exp : exp;
+      p = e;
+    }
+  }
+  /* strtod would read "0x..." as hex */
+  if (p < end && (*p == 'x' || *p == 'X')) return 0;
+
+  if (w == 0) {
+    *d = neg ? -0.0 : 0.0;
+    return p - str;
+  }
+  /* Both w and 10^|q| are exact doubles, so a single IEEE operation rounds correctly */
+  if (w <= (1ULL << 53) && q >= -22 && q <= 22) {
+    double v = (double)w;
+    v = q < 0 ? v / exactPow10[-q] : v * exactPow10[q];
+    *d = neg ? -v : v;
+    return p - str;
+  }
+  if (q < POW10_MIN || q > POW10_MAX || !eiselLemire(w, q, neg, d)) return 0;
+  return p - str;
+}
@@ -0,0 +1,12 @@
+#ifndef __RMR_FAST_FLOAT_H__
+#define __RMR_FAST_FLOAT_H__
+
+#include <stddef.h>
+
+/* Parse a decimal floating point number from the start of str without going through the locale.
+ * Returns the number of characters consumed, or 0 if str does not start with a number that can be
+ * rounded exactly here (hex, inf/nan, more than 19 significant digits or an extreme exponent), in
+ * which case the caller should fall back to strtod */
+size_t fast_strtod(const char *str, size_t len, double *d);
+
+#endif
@@ -0,0 +1,56 @@
+#include "lz4.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Read an LZ4 length: the 4 bits from the token, continued by extra bytes while they are 255 */
+static int readLength(const uint8_t **ip, const uint8_t *end, size_t *len) {
+  if (*len != 15) return 1;
+  uint8_t b;
+  do {
+    if (*ip == end) return 0;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return 1;
+}
+
+long lz4_decompress(const char *src, size_t srcLen, char *dst, size_t dstLen) {
+  const uint8_t *ip = (const uint8_t *)src;
+  const uint8_t *end = ip + srcLen;
+  uint8_t *op = (uint8_t *)dst;
+  uint8_t *oend = op + dstLen;
+
+  while (ip < end) {
+    uint8_t token = *ip++;
+
+    size_t litLen = token >> 4;
+    if (!readLength(&ip, end, &litLen)) return -1;
+    if ((size_t)(end - ip) < litLen || (size_t)(oend - op) < litLen) return -1;
+    memcpy(op, ip, litLen);
+    ip += litLen;
+    op += litLen;
+
+    // the last sequence has only literals
+    if (ip == end) break;
+
+    if (end - ip < 2) return -1;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst)) return -1;
+
+    size_t matchLen = token & 15;
+    if (!readLength(&ip, end, &matchLen)) return -1;
+    matchLen += 4;
+    if ((size_t)(oend - op) < matchLen) return -1;
+
+    // a match may overlap the bytes it produces, in which case it is copied one byte at a time
+    const uint8_t *match = op - offset;
+    if (offset >= matchLen) {
+      memcpy(op, match, matchLen);
+      op += matchLen;
+    } else {
+      while (matchLen--) *op++ = *match++;
+    }
+  }
+  return op - (uint8_t *)dst;
+}
@@ -0,0 +1,10 @@
+#ifndef __RMR_LZ4_H__
+#define __RMR_LZ4_H__
+
+#include <stddef.h>
+
+/* Decompress a single LZ4 block into dst, which must be able to hold dstLen bytes. Returns the
+ * number of bytes written, or -1 if the block is malformed or does not fit in dst */
+long lz4_decompress(const char *src, size_t srcLen, char *dst, size_t dstLen);
+
+#endif
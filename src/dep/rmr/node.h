@@ -38,6 +38,8 @@ MRNodeMap *MR_NewNodeMap();
 void MRNodeMap_Free(MRNodeMap *m);
 void MRNodeMap_Add(MRNodeMap *m, MRClusterNode *n);
 MRClusterNode *MRNodeMap_RandomNode(MRNodeMap *m);
+/* Find a node by its "host:port" address, return NULL if it is not in the map */
+MRClusterNode *MRNodeMap_FindByAddress(MRNodeMap *m, const char *addr, size_t len);
 size_t MRNodeMap_NumHosts(MRNodeMap *m);
 size_t MRNodeMap_NumNodes(MRNodeMap *m);
 #endif
\ No newline at end of file
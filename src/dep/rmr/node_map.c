@@ -101,6 +101,14 @@ void MRNodeMap_Add(MRNodeMap *m, MRClusterNode *n) {
   free(addr);
 }
 
+MRClusterNode *MRNodeMap_FindByAddress(MRNodeMap *m, const char *addr, size_t len) {
+  void *p = TrieMap_Find(m->nodes, (char *)addr, len);
+  if (p == TRIEMAP_NOTFOUND) {
+    return NULL;
+  }
+  return p;
+}
+
 MRClusterNode *MRNodeMap_RandomNode(MRNodeMap *m) {
   char *k;
   tm_len_t len;
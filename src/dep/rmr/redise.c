@@ -4,32 +4,24 @@
 MRClusterTopology *RedisEnterprise_ParseTopology(RedisModuleCtx *ctx, RedisModuleString **argv,
                                                  int argc) {
 
-  size_t totalLen = 0;
-  const char *cargs[argc];
-  size_t lens[argc];
+  // feed the arguments to the parser as is, redis strings are already NULL terminated
+  const char **cargs = malloc(argc * sizeof(*cargs));
+  size_t *lens = malloc(argc * sizeof(*lens));
   for (int i = 1; i < argc; i++) {
     cargs[i - 1] = RedisModule_StringPtrLen(argv[i], &lens[i - 1]);
-    totalLen += lens[i - 1] + 1;
   }
+  RedisModule_Log(ctx, "notice", "Got topology update with %d arguments", argc - 1);
 
-  char *str = calloc(totalLen + 2, 1);
-  char *p = str;
-  for (int i = 0; i < argc - 1; i++) {
-    strncpy(p, cargs[i], lens[i]);
-    p += lens[i];
-    *p++ = ' ';
-  }
-  p--;
-  *p = 0;
-  RedisModule_Log(ctx, "notice", "Got topology update: %s", str);
   char *err = NULL;
-  MRClusterTopology *topo = MR_ParseTopologyRequest(str, strlen(str), &err);
+  MRClusterTopology *topo = MR_ParseTopologyArgv(cargs, lens, argc - 1, &err);
+  free(cargs);
+  free(lens);
   if (err != NULL) {
     RedisModule_Log(ctx, "warning", "Could not parse cluster topology: %s\n", err);
     RedisModule_ReplyWithError(ctx, err);
+    free(err);
     return NULL;
   }
-  free(str);
 
   return topo;
 }
@@ -1,20 +1,34 @@
 #include "parser_ctx.h"
+#include "token.h"
+#include "grammar.h"
 #include "../cluster.h"
 #include "../node.h"
 #include "../endpoint.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* The lemon generated parser API, see grammar.c */
+void *MRTopologyRequest_ParseAlloc(void *(*mallocProc)(size_t));
+void MRTopologyRequest_Parse(void *yyp, int yymajor, Token yyminor, parseCtx *ctx);
+void MRTopologyRequest_ParseFree(void *p, void (*freeProc)(void *));
+
 void MRTopology_AddRLShard(MRClusterTopology *t, RLShard *sh) {
 
   int found = -1;
-  for (int i = 0; i < t->numShards; i++) {
+  // replicas of the same range usually come one after the other, so check the last shard first
+  if (t->numShards > 0 && sh->startSlot == t->shards[t->numShards - 1].startSlot &&
+      sh->endSlot == t->shards[t->numShards - 1].endSlot) {
+    found = t->numShards - 1;
+  }
+  for (int i = 0; i < t->numShards && found < 0; i++) {
     if (sh->startSlot == t->shards[i].startSlot && sh->endSlot == t->shards[i].endSlot) {
       found = i;
       break;
     }
   }
 
-  printf("Adding rl node %s to %s shard %d..%d\n", sh->node.id, found >= 0 ? "found" : "", sh->startSlot, sh->endSlot);
-
   if (found >= 0) {
     MRClusterShard_AddNode(&t->shards[found], &sh->node);
   } else {
@@ -22,4 +36,67 @@ void MRTopology_AddRLShard(MRClusterTopology *t, RLShard *sh) {
     MRClusterShard_AddNode(&csh, &sh->node);
     MRClusterTopology_AddShard(t, &csh);
   }
-}
\ No newline at end of file
+}
+
+static const struct {
+  const char *str;
+  int id;
+} topologyKeywords_g[] = {
+    {"MYID", MYID},
+    {"HASREPLICATION", HASREPLICATION},
+    {"RANGES", RANGES},
+    {"SHARD", SHARD},
+    {"SLOTRANGE", SLOTRANGE},
+    {"ADDR", ADDR},
+    {"UNIXADDR", UNIXADDR},
+    {"MASTER", MASTER},
+    {"HASHFUNC", HASHFUNC},
+    {"NUMSLOTS", NUMSLOTS},
+};
+
+/* Classify a single argument the same way the lexer does: a keyword (case insensitive), an
+ * integer, or a string */
+static int topologyTokenType(const char *s, size_t len, Token *t) {
+  for (size_t i = 0; i < sizeof(topologyKeywords_g) / sizeof(topologyKeywords_g[0]); i++) {
+    const char *kw = topologyKeywords_g[i].str;
+    if (len == strlen(kw) && !strncasecmp(s, kw, len)) {
+      return topologyKeywords_g[i].id;
+    }
+  }
+
+  size_t i = (len > 1 && (*s == '-' || *s == '+')) ? 1 : 0;
+  int isInt = len > 0;
+  for (; i < len && isInt; i++) {
+    isInt = s[i] >= '0' && s[i] <= '9';
+  }
+  if (isInt) {
+    t->intval = strtoll(s, NULL, 10);
+    return INTEGER;
+  }
+  t->strval = (char *)s;
+  return STRING;
+}
+
+MRClusterTopology *MR_ParseTopologyArgv(const char **args, const size_t *lens, int argc,
+                                        char **err) {
+  void *pParser = MRTopologyRequest_ParseAlloc(malloc);
+  parseCtx ctx = {.topology = NULL, .ok = 1, .replication = 0, .my_id = NULL,
+                  .errorMsg = NULL, .numSlots = 0, .shardFunc = NULL};
+
+  Token t = {0};
+  for (int i = 0; i < argc && ctx.ok; i++) {
+    t = (Token){.s = (char *)args[i], .len = lens[i], .pos = i};
+    int type = topologyTokenType(args[i], lens[i], &t);
+    MRTopologyRequest_Parse(pParser, type, t, &ctx);
+  }
+  MRTopologyRequest_Parse(pParser, 0, t, &ctx);
+  MRTopologyRequest_ParseFree(pParser, free);
+
+  if (err) {
+    *err = ctx.errorMsg;
+  }
+  if (ctx.my_id) {
+    free(ctx.my_id);
+  }
+  return ctx.topology;
+}
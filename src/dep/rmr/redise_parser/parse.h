@@ -13,4 +13,10 @@ typedef struct {
 
 void MRTopology_AddRLShard(MRClusterTopology *t, RLShard *sh);
 MRClusterTopology *MR_ParseTopologyRequest(const char *c, size_t len, char **err);
+
+/* Parse a topology request given as separate arguments, each argument being a single token. The
+ * arguments must be NULL terminated strings, and are not copied or modified. This avoids joining
+ * the arguments and re-lexing them */
+MRClusterTopology *MR_ParseTopologyArgv(const char **args, const size_t *lens, int argc,
+                                        char **err);
 #endif
\ No newline at end of file
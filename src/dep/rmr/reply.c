@@ -1,11 +1,485 @@
 #define __RMR_REPLY_C__
 #include "reply.h"
 #include "hiredis/hiredis.h"
+#include "lz4.h"
+#include "fast_float.h"
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
+#include <stddef.h>
+#include <assert.h>
 #include <redismodule.h>
 
+/* Replies read from shards are allocated from a per-reply arena, instead of one allocation per
+ * element and string. The root reply is allocated together with the arena header and its first
+ * chunk, and everything below it is bump-allocated from chained chunks, so the whole tree is freed
+ * at once */
+typedef struct MRReplyChunk {
+  struct MRReplyChunk *next;
+  size_t used;
+  size_t cap;
+  char data[];
+} MRReplyChunk;
+
+typedef struct {
+  MRReplyChunk *chunks;
+  /* Encoded nested values of a lazy reply */
+  char *raw;
+  size_t rawLen;
+  size_t rawCap;
+  int lazy;
+  MRReply root;
+} MRReplyArena;
+
+#define MRREPLY_CHUNK_MIN 4096
+#define MRREPLY_CHUNK_MAX (1 << 20)
+/* Rough arena size of a single array element: the reply, its slot in the array and a short string */
+#define MRREPLY_ELEMENT_SIZE (sizeof(MRReply) + sizeof(MRReply *) + 16)
+
+#define MRREPLY_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+/* Returned to the reader for values that are only encoded, it is never linked into a reply */
+static MRReply encodedPlaceholder_g;
+
+static inline MRReplyArena *replyArena(const MRReply *root) {
+  return (MRReplyArena *)((char *)root - offsetof(MRReplyArena, root));
+}
+
+/* The chunk allocated together with the arena header, which is not freed on its own */
+static inline MRReplyChunk *inlineChunk(MRReplyArena *a) {
+  return (MRReplyChunk *)(a + 1);
+}
+
+static void *arenaAlloc(MRReplyArena *a, size_t n) {
+  n = MRREPLY_ALIGN(n);
+  MRReplyChunk *c = a->chunks;
+  if (c->cap - c->used < n) {
+    size_t cap = c->cap * 2;
+    if (cap < MRREPLY_CHUNK_MIN) cap = MRREPLY_CHUNK_MIN;
+    if (cap > MRREPLY_CHUNK_MAX) cap = MRREPLY_CHUNK_MAX;
+    if (cap < n) cap = n;
+    c = hi_malloc(sizeof(*c) + cap);
+    if (!c) return NULL;
+    c->next = a->chunks;
+    c->used = 0;
+    c->cap = cap;
+    a->chunks = c;
+  }
+  void *p = c->data + c->used;
+  c->used += n;
+  return p;
+}
+
+void MRReply_Free(MRReply *reply) {
+  if (!reply) return;
+  MRReplyArena *a = replyArena(reply);
+  MRReplyChunk *c = a->chunks;
+  while (c) {
+    MRReplyChunk *next = c->next;
+    if (c != inlineChunk(a)) {
+      hi_free(c);
+    }
+    c = next;
+  }
+  hi_free(a->raw);
+  hi_free(a);
+}
+
+static void freeReplyArena(void *reply) {
+  MRReply_Free(reply);
+}
+
+/*
+ * Lazy replies.
+ *
+ * In a lazy reply only the root and its direct elements are created while reading. Arrays below
+ * the root keep their element count, and everything nested in them is appended to the arena's raw
+ * buffer instead:
+ *
+ *   strings:  type, size_t length, the bytes and a null terminator
+ *   integers: type, long long value
+ *   doubles:  type, double value, then its string as above
+ *   nil:      type
+ *   arrays:   type, size_t number of elements, followed by the elements
+ *
+ * An encoded array reply has no element array, its str points to the arena and its len is the
+ * offset of its first element in the raw buffer. MRReply_Materialize parses a single level of it,
+ * so search results that are dropped from the heap never have their fields parsed.
+ */
+
+/* Sets and pushes are read as arrays, and verbatim and big number strings as plain strings */
+static int replyType(int type) {
+  switch (type) {
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_PUSH:
+      return REDIS_REPLY_ARRAY;
+    case REDIS_REPLY_VERB:
+    case REDIS_REPLY_BIGNUM:
+      return REDIS_REPLY_STRING;
+    default:
+      return type;
+  }
+}
+
+static int isAggregateType(int type) {
+  return type == REDIS_REPLY_ARRAY || type == REDIS_REPLY_MAP || type == REDIS_REPLY_SET ||
+         type == REDIS_REPLY_PUSH || type == REDIS_REPLY_ATTR;
+}
+
+static char *rawAppend(MRReplyArena *a, const void *p, size_t n) {
+  if (a->rawCap - a->rawLen < n) {
+    size_t cap = a->rawCap ? a->rawCap * 2 : MRREPLY_CHUNK_MIN;
+    while (cap - a->rawLen < n) cap *= 2;
+    char *raw = hi_realloc(a->raw, cap);
+    if (!raw) return NULL;
+    a->raw = raw;
+    a->rawCap = cap;
+  }
+  char *dst = a->raw + a->rawLen;
+  if (p) memcpy(dst, p, n);
+  a->rawLen += n;
+  return dst;
+}
+
+static void *encodeValue(MRReplyArena *a, int type, const void *num, size_t numLen,
+                         const char *str, size_t len) {
+  uint8_t t = type;
+  if (!rawAppend(a, &t, 1)) return NULL;
+  if (num && !rawAppend(a, num, numLen)) return NULL;
+  if (str) {
+    if (!rawAppend(a, &len, sizeof(len)) || !rawAppend(a, str, len) || !rawAppend(a, "", 1)) {
+      return NULL;
+    }
+  }
+  return &encodedPlaceholder_g;
+}
+
+/* Return the arena of the reply a nested value belongs to, if the value should be encoded rather
+ * than created */
+static MRReplyArena *encodingArena(const redisReadTask *task) {
+  if (!task->parent || !task->parent->parent) {
+    return NULL;
+  }
+  const redisReadTask *rootTask = task->parent->parent;
+  while (rootTask->parent) rootTask = rootTask->parent;
+  MRReplyArena *a = replyArena(rootTask->obj);
+  return a->lazy ? a : NULL;
+}
+
+static size_t decodeSize(const char *p) {
+  size_t n;
+  memcpy(&n, p, sizeof(n));
+  return n;
+}
+
+/* Skip n encoded values starting at pos, and return the position after them */
+static size_t skipEncoded(const char *raw, size_t pos, size_t n) {
+  while (n--) {
+    int type = (uint8_t)raw[pos++];
+    switch (type) {
+      case REDIS_REPLY_INTEGER:
+      case REDIS_REPLY_BOOL:
+        pos += sizeof(long long);
+        break;
+      case REDIS_REPLY_DOUBLE:
+        pos += sizeof(double);
+        pos += sizeof(size_t) + decodeSize(raw + pos) + 1;
+        break;
+      case REDIS_REPLY_NIL:
+        break;
+      default:
+        if (isAggregateType(type)) {
+          n += decodeSize(raw + pos);
+          pos += sizeof(size_t);
+        } else {
+          pos += sizeof(size_t) + decodeSize(raw + pos) + 1;
+        }
+    }
+  }
+  return pos;
+}
+
+/* Decode the value at pos into r, and return the position of the next value */
+static size_t decodeValue(MRReplyArena *a, size_t pos, MRReply *r) {
+  const char *raw = a->raw;
+  memset(r, 0, sizeof(*r));
+  r->type = (uint8_t)raw[pos++];
+  switch (r->type) {
+    case REDIS_REPLY_INTEGER:
+    case REDIS_REPLY_BOOL:
+      memcpy(&r->integer, raw + pos, sizeof(r->integer));
+      return pos + sizeof(r->integer);
+    case REDIS_REPLY_NIL:
+      return pos;
+    case REDIS_REPLY_DOUBLE:
+      memcpy(&r->dval, raw + pos, sizeof(r->dval));
+      pos += sizeof(r->dval);
+      break;
+    default:
+      if (isAggregateType(r->type)) {
+        r->elements = decodeSize(raw + pos);
+        pos += sizeof(size_t);
+        r->str = (char *)a;
+        r->len = pos;
+        return skipEncoded(raw, pos, r->elements);
+      }
+  }
+  // strings point into the raw buffer, which does not move once the reply has been read
+  r->len = decodeSize(raw + pos);
+  pos += sizeof(size_t);
+  r->str = (char *)raw + pos;
+  return pos + r->len + 1;
+}
+
+void MRReply_Materialize(MRReply *reply) {
+  if (reply->element || !reply->elements) {
+    return;
+  }
+  MRReplyArena *a = (MRReplyArena *)reply->str;
+  size_t pos = reply->len;
+  MRReply **elements = arenaAlloc(a, reply->elements * sizeof(*elements));
+  MRReply *objs = arenaAlloc(a, reply->elements * sizeof(*objs));
+  for (size_t i = 0; i < reply->elements; i++) {
+    pos = decodeValue(a, pos, &objs[i]);
+    elements[i] = &objs[i];
+  }
+  reply->element = elements;
+  reply->str = NULL;
+  reply->len = 0;
+}
+
+/* Create a reply for a reader task. The root reply creates the arena, with a first chunk of
+ * sizeHint bytes; nested replies are allocated from the root's arena and linked to their parent */
+static MRReply *createReply(const redisReadTask *task, size_t sizeHint, MRReplyArena **arena) {
+  MRReply *r;
+  if (!task->parent) {
+    sizeHint = MRREPLY_ALIGN(sizeHint);
+    MRReplyArena *a = hi_malloc(sizeof(*a) + sizeof(MRReplyChunk) + sizeHint);
+    if (!a) return NULL;
+    a->chunks = inlineChunk(a);
+    a->chunks->next = NULL;
+    a->chunks->used = 0;
+    a->chunks->cap = sizeHint;
+    a->raw = NULL;
+    a->rawLen = a->rawCap = 0;
+    a->lazy = task->privdata ? MRReplyModeQueue_Pop(task->privdata) & MRREPLY_MODE_LAZY : 0;
+    r = &a->root;
+    *arena = a;
+  } else {
+    const redisReadTask *rootTask = task->parent;
+    while (rootTask->parent) rootTask = rootTask->parent;
+    *arena = replyArena(rootTask->obj);
+    r = arenaAlloc(*arena, sizeof(*r));
+    if (!r) return NULL;
+    MRReply *parent = task->parent->obj;
+    parent->element[task->idx] = r;
+  }
+  memset(r, 0, sizeof(*r));
+  r->type = replyType(task->type);
+  return r;
+}
+
+static void *createStringReply(const redisReadTask *task, char *str, size_t len);
+
+static MRReplyCompressionStats compressionStats_g;
+
+MRReplyCompressionStats MRReply_GetCompressionStats(void) {
+  return compressionStats_g;
+}
+
+static int isCompressedFrame(const redisReadTask *task, const char *str, size_t len) {
+  MRReplyModeQueue *q = task->privdata;
+  return !task->parent && task->type == REDIS_REPLY_STRING && q && q->len &&
+         (q->modes[q->head] & MRREPLY_MODE_COMPRESSED) && len >= MRREPLY_LZ4_HEADER_SIZE &&
+         !memcmp(str, MRREPLY_LZ4_MAGIC, 4);
+}
+
+/* Decompress a compressed frame and parse the reply it holds, with the frame's own parsing mode */
+static void *inflateReply(const redisReadTask *task, const char *frame, size_t len) {
+  int mode = MRReplyModeQueue_Pop(task->privdata) & ~MRREPLY_MODE_COMPRESSED;
+  uint32_t size;
+  memcpy(&size, frame + 4, sizeof(size));
+
+  void *reply = NULL;
+  const char *block = frame + MRREPLY_LZ4_HEADER_SIZE;
+  size_t blockLen = len - MRREPLY_LZ4_HEADER_SIZE;
+  // don't trust the header with a size the block can't hold
+  char *buf = NULL;
+  if (size <= MRREPLY_LZ4_MAX_RATIO * blockLen) {
+    buf = hi_malloc(size ? size : 1);
+    if (!buf) return NULL;
+  }
+  if (buf && lz4_decompress(block, blockLen, buf, size) == size) {
+    MRReplyModeQueue modes = {0};
+    MRReplyModeQueue_Push(&modes, mode);
+    redisReader *r = redisReaderCreateWithFunctions(&MRReply_ArenaFunctions);
+    if (r) {
+      r->privdata = &modes;
+      if (redisReaderFeed(r, buf, size) != REDIS_OK || redisReaderGetReply(r, &reply) != REDIS_OK) {
+        reply = NULL;
+      }
+      redisReaderFree(r);
+    }
+    MRReplyModeQueue_Free(&modes);
+  }
+  hi_free(buf);
+
+  if (!reply) {
+    static const char err[] = "ERR Could not decompress shard reply";
+    redisReadTask errTask = {.type = REDIS_REPLY_ERROR};
+    return createStringReply(&errTask, (char *)err, sizeof(err) - 1);
+  }
+  compressionStats_g.numReplies++;
+  compressionStats_g.compressedBytes += len;
+  compressionStats_g.inflatedBytes += size;
+  return reply;
+}
+
+static void *createStringReply(const redisReadTask *task, char *str, size_t len) {
+  if (isCompressedFrame(task, str, len)) {
+    return inflateReply(task, str, len);
+  }
+
+  int type = task->type;
+  if (type == REDIS_REPLY_VERB) {
+    // skip the 4 bytes of the verbatim type header
+    str += 4;
+    len -= 4;
+  }
+
+  MRReplyArena *a = encodingArena(task);
+  if (a) {
+    return encodeValue(a, replyType(type), NULL, 0, str, len);
+  }
+
+  MRReply *r = createReply(task, len + 1, &a);
+  if (!r) return NULL;
+  if (type == REDIS_REPLY_VERB) {
+    memcpy(r->vtype, str - 4, 3);
+  }
+  char *buf = arenaAlloc(a, len + 1);
+  if (!buf) {
+    if (!task->parent) MRReply_Free(r);
+    return NULL;
+  }
+  memcpy(buf, str, len);
+  buf[len] = '\0';
+  r->str = buf;
+  r->len = len;
+  return r;
+}
+
+static void *createArrayReply(const redisReadTask *task, size_t elements) {
+  MRReplyArena *a = encodingArena(task);
+  if (a) {
+    return encodeValue(a, replyType(task->type), &elements, sizeof(elements), NULL, 0);
+  }
+
+  size_t hint = elements * MRREPLY_ELEMENT_SIZE;
+  MRReply *r = createReply(task, hint < MRREPLY_CHUNK_MAX ? hint : MRREPLY_CHUNK_MAX, &a);
+  if (!r) return NULL;
+  r->elements = elements;
+  if (elements == 0) {
+    return r;
+  }
+
+  if (task->parent && a->lazy) {
+    // an element of a lazy reply, its own elements follow in the raw buffer
+    r->str = (char *)a;
+    r->len = a->rawLen;
+    return r;
+  }
+  r->element = arenaAlloc(a, elements * sizeof(*r->element));
+  if (!r->element) {
+    if (!task->parent) MRReply_Free(r);
+    return NULL;
+  }
+  memset(r->element, 0, elements * sizeof(*r->element));
+  return r;
+}
+
+static void *createIntegerReply(const redisReadTask *task, long long value) {
+  MRReplyArena *a = encodingArena(task);
+  if (a) {
+    return encodeValue(a, task->type, &value, sizeof(value), NULL, 0);
+  }
+  MRReply *r = createReply(task, 0, &a);
+  if (r) r->integer = value;
+  return r;
+}
+
+static void *createDoubleReply(const redisReadTask *task, double value, char *str, size_t len) {
+  MRReplyArena *a = encodingArena(task);
+  if (a) {
+    return encodeValue(a, task->type, &value, sizeof(value), str, len);
+  }
+  MRReply *r = createStringReply(task, str, len);
+  if (r) r->dval = value;
+  return r;
+}
+
+static void *createNilReply(const redisReadTask *task) {
+  MRReplyArena *a = encodingArena(task);
+  if (a) {
+    return encodeValue(a, task->type, NULL, 0, NULL, 0);
+  }
+  return createReply(task, 0, &a);
+}
+
+static void *createBoolReply(const redisReadTask *task, int value) {
+  long long integer = value != 0;
+  MRReplyArena *a = encodingArena(task);
+  if (a) {
+    return encodeValue(a, task->type, &integer, sizeof(integer), NULL, 0);
+  }
+  MRReply *r = createReply(task, 0, &a);
+  if (r) r->integer = integer;
+  return r;
+}
+
+redisReplyObjectFunctions MRReply_ArenaFunctions = {
+    .createString = createStringReply,
+    .createArray = createArrayReply,
+    .createInteger = createIntegerReply,
+    .createDouble = createDoubleReply,
+    .createNil = createNilReply,
+    .createBool = createBoolReply,
+    .freeObject = freeReplyArena,
+};
+
+void MRReplyModeQueue_Push(MRReplyModeQueue *q, int mode) {
+  if (q->len == q->cap) {
+    size_t cap = q->cap ? q->cap * 2 : 16;
+    uint8_t *modes = malloc(cap);
+    for (size_t i = 0; i < q->len; i++) {
+      modes[i] = q->modes[(q->head + i) % q->cap];
+    }
+    free(q->modes);
+    q->modes = modes;
+    q->cap = cap;
+    q->head = 0;
+  }
+  q->modes[(q->head + q->len++) % q->cap] = mode;
+}
+
+int MRReplyModeQueue_Pop(MRReplyModeQueue *q) {
+  if (!q->len) {
+    return 0;
+  }
+  int mode = q->modes[q->head];
+  q->head = (q->head + 1) % q->cap;
+  q->len--;
+  return mode;
+}
+
+void MRReplyModeQueue_Clear(MRReplyModeQueue *q) {
+  q->head = q->len = 0;
+}
+
+void MRReplyModeQueue_Free(MRReplyModeQueue *q) {
+  free(q->modes);
+  *q = (MRReplyModeQueue){0};
+}
 
 int MRReply_StringEquals(MRReply *r, const char *s, int caseSensitive) {
   if (!r || MRReply_Type(r) != MR_REPLY_STRING) return 0;
@@ -27,8 +501,12 @@ void MRReply_Print(FILE *fp, MRReply *r) {
 
   switch (MRReply_Type(r)) {
     case MR_REPLY_INTEGER:
+    case MR_REPLY_BOOL:
       fprintf(fp, "INT(%lld)", MRReply_Integer(r));
       break;
+    case MR_REPLY_DOUBLE:
+      fprintf(fp, "DOUBLE(%g)", MRReply_Double(r));
+      break;
     case MR_REPLY_STRING:
     case MR_REPLY_STATUS:
       fprintf(fp, "STR(%s)", MRReply_String(r, NULL));
@@ -40,7 +518,8 @@ void MRReply_Print(FILE *fp, MRReply *r) {
       fprintf(fp, "(nil)");
       break;
     case MR_REPLY_ARRAY:
-      fprintf(fp, "ARR(%zd):[ ", MRReply_Length(r));
+    case MR_REPLY_MAP:
+      fprintf(fp, "%s(%zd):[ ", MRReply_Type(r) == MR_REPLY_MAP ? "MAP" : "ARR", MRReply_Length(r));
       for (size_t i = 0; i < MRReply_Length(r); i++) {
         MRReply_Print(fp, MRReply_ArrayElement(r, i));
         fprintf(fp, ", ");
@@ -70,6 +549,10 @@ int _parseInt(const char *str, size_t len, long long *i) {
 }
 
 int _parseFloat(const char *str, size_t len, double *d) {
+  // scores are plain decimals, which mostly round exactly without going through strtod
+  if (len && fast_strtod(str, len, d) == len) {
+    return 1;
+  }
   errno = 0; /* To distinguish success/failure after call */
   char *endptr = (char *)str + len;
   double val = strtod(str, &endptr);
@@ -88,8 +571,12 @@ int MRReply_ToInteger(MRReply *reply, long long *i) {
 
   switch (MRReply_Type(reply)) {
     case MR_REPLY_INTEGER:
+    case MR_REPLY_BOOL:
       *i = MRReply_Integer(reply);
       return 1;
+    case MR_REPLY_DOUBLE:
+      *i = (long long)MRReply_Double(reply);
+      return 1;
     case MR_REPLY_STRING:
     case MR_REPLY_STATUS: {
       size_t n;
@@ -105,7 +592,12 @@ int MRReply_ToDouble(MRReply *reply, double *d) {
   if (reply == NULL) return 0;
 
   switch (MRReply_Type(reply)) {
+    case MR_REPLY_DOUBLE:
+      *d = MRReply_Double(reply);
+      return 1;
+
     case MR_REPLY_INTEGER:
+    case MR_REPLY_BOOL:
       *d = (double)MRReply_Integer(reply);
       return 1;
 
@@ -122,10 +614,69 @@ int MRReply_ToDouble(MRReply *reply, double *d) {
   }
 }
 
+/* Relay n encoded values of a lazy reply to the client, in a single pass over the raw buffer and
+ * without materializing them */
+static void replyWithEncoded(RedisModuleCtx *ctx, const char *raw, size_t pos, size_t n) {
+  while (n--) {
+    int type = (uint8_t)raw[pos++];
+    switch (type) {
+      case REDIS_REPLY_ARRAY:
+      case REDIS_REPLY_MAP: {
+        size_t elements = decodeSize(raw + pos);
+        pos += sizeof(size_t);
+        RedisModule_ReplyWithArray(ctx, elements);
+        n += elements;
+        break;
+      }
+      case REDIS_REPLY_INTEGER:
+      case REDIS_REPLY_BOOL: {
+        long long i;
+        memcpy(&i, raw + pos, sizeof(i));
+        pos += sizeof(i);
+        RedisModule_ReplyWithLongLong(ctx, i);
+        break;
+      }
+      case REDIS_REPLY_DOUBLE: {
+        double d;
+        memcpy(&d, raw + pos, sizeof(d));
+        pos = skipEncoded(raw, pos - 1, 1);
+        RedisModule_ReplyWithDouble(ctx, d);
+        break;
+      }
+      case REDIS_REPLY_STRING:
+      case REDIS_REPLY_STATUS:
+      case REDIS_REPLY_ERROR: {
+        size_t len = decodeSize(raw + pos);
+        const char *str = raw + pos + sizeof(size_t);
+        pos += sizeof(size_t) + len + 1;
+        if (type == REDIS_REPLY_STRING) {
+          RedisModule_ReplyWithStringBuffer(ctx, str, len);
+        } else if (type == REDIS_REPLY_STATUS) {
+          RedisModule_ReplyWithSimpleString(ctx, str);
+        } else {
+          RedisModule_ReplyWithError(ctx, str);
+        }
+        break;
+      }
+      default:
+        // same as MR_ReplyWithMRReply, anything else is relayed as null
+        pos = skipEncoded(raw, pos - 1, 1);
+        RedisModule_ReplyWithNull(ctx);
+    }
+  }
+}
+
 int MR_ReplyWithMRReply(RedisModuleCtx *ctx, MRReply *rep) {
   if (rep == NULL) {
     return RedisModule_ReplyWithNull(ctx);
   }
+  int type = MRReply_Type(rep);
+  if ((type == MR_REPLY_ARRAY || type == MR_REPLY_MAP) && !rep->element && rep->elements) {
+    MRReplyArena *a = (MRReplyArena *)rep->str;
+    RedisModule_ReplyWithArray(ctx, rep->elements);
+    replyWithEncoded(ctx, a->raw, rep->len, rep->elements);
+    return REDISMODULE_OK;
+  }
   switch (MRReply_Type(rep)) {
 
     case MR_REPLY_STRING: {
@@ -137,7 +688,9 @@ int MR_ReplyWithMRReply(RedisModuleCtx *ctx, MRReply *rep) {
     case MR_REPLY_STATUS:
       return RedisModule_ReplyWithSimpleString(ctx, MRReply_String(rep, NULL));
 
-    case MR_REPLY_ARRAY: {
+    // maps are relayed flattened, as they are in RESP2
+    case MR_REPLY_ARRAY:
+    case MR_REPLY_MAP: {
       RedisModule_ReplyWithArray(ctx, MRReply_Length(rep));
       for (size_t i = 0; i < MRReply_Length(rep); i++) {
         MR_ReplyWithMRReply(ctx, MRReply_ArrayElement(rep, i));
@@ -146,8 +699,12 @@ int MR_ReplyWithMRReply(RedisModuleCtx *ctx, MRReply *rep) {
     }
 
     case MR_REPLY_INTEGER:
+    case MR_REPLY_BOOL:
       return RedisModule_ReplyWithLongLong(ctx, MRReply_Integer(rep));
 
+    case MR_REPLY_DOUBLE:
+      return RedisModule_ReplyWithDouble(ctx, MRReply_Double(rep));
+
     case MR_REPLY_ERROR:
       return RedisModule_ReplyWithError(ctx, MRReply_String(rep, NULL));
 
@@ -11,12 +11,57 @@
 #define MR_REPLY_NIL 4
 #define MR_REPLY_STATUS 5
 #define MR_REPLY_ERROR 6
+/* RESP3 types, replied by shards on connections that negotiated protocol 3. Maps keep their keys
+ * and values flattened in the elements, like arrays */
+#define MR_REPLY_DOUBLE 7
+#define MR_REPLY_BOOL 8
+#define MR_REPLY_MAP 9
+#define MR_REPLY_ATTR 11
 
 typedef struct redisReply MRReply;
 
-static inline void MRReply_Free(MRReply *reply) {
-  freeReplyObject(reply);
-}
+/* Reply object functions for the hiredis reader, building each reply tree in a single arena. If the
+ * reader's privdata is an MRReplyModeQueue, each reply pops its parsing mode from it */
+extern redisReplyObjectFunctions MRReply_ArenaFunctions;
+
+/* A lazy reply only materializes its top level elements while reading; arrays nested in them are
+ * kept encoded until accessed */
+#define MRREPLY_MODE_LAZY 0x01
+/* The reply may arrive as a compressed frame: a bulk string made of MRREPLY_LZ4_MAGIC, the uint32
+ * size of the original reply and an LZ4 block holding it. The frame is decompressed and parsed
+ * in its place, so readers never see it */
+#define MRREPLY_MODE_COMPRESSED 0x02
+
+#define MRREPLY_LZ4_MAGIC "\0LZ4"
+#define MRREPLY_LZ4_HEADER_SIZE 8
+/* An LZ4 block can't expand by more than this, frames claiming a larger size are rejected */
+#define MRREPLY_LZ4_MAX_RATIO 255
+
+/* A FIFO of parsing modes for the pending replies of a connection */
+typedef struct {
+  uint8_t *modes;
+  size_t cap;
+  size_t head;
+  size_t len;
+} MRReplyModeQueue;
+
+void MRReplyModeQueue_Push(MRReplyModeQueue *q, int mode);
+int MRReplyModeQueue_Pop(MRReplyModeQueue *q);
+void MRReplyModeQueue_Clear(MRReplyModeQueue *q);
+void MRReplyModeQueue_Free(MRReplyModeQueue *q);
+
+/* Total sizes of the compressed reply frames read so far, and of the replies they held. Only
+ * updated by the thread reading replies, so other threads may read slightly stale values */
+typedef struct {
+  size_t numReplies;
+  size_t compressedBytes;
+  size_t inflatedBytes;
+} MRReplyCompressionStats;
+
+MRReplyCompressionStats MRReply_GetCompressionStats(void);
+
+/* Free a reply tree built with MRReply_ArenaFunctions. Must only be called on a root reply */
+void MRReply_Free(MRReply *reply);
 
 static inline int MRReply_Type(MRReply *reply) {
   return reply->type;
@@ -26,6 +71,10 @@ static inline long long MRReply_Integer(MRReply *reply) {
   return reply->integer;
 }
 
+static inline double MRReply_Double(MRReply *reply) {
+  return reply->dval;
+}
+
 static inline size_t MRReply_Length(MRReply *reply) {
   return reply->elements;
 }
@@ -40,7 +89,13 @@ static inline char *MRReply_String(MRReply *reply, size_t *len) {
   return reply->str;
 }
 
+/* Parse the elements of an array that was kept encoded by a lazy reply */
+void MRReply_Materialize(MRReply *reply);
+
 static inline MRReply *MRReply_ArrayElement(MRReply *reply, size_t idx) {
+  if (!reply->element) {
+    MRReply_Materialize(reply);
+  }
   return reply->element[idx];
 }
 
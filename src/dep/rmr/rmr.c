@@ -57,6 +57,20 @@ typedef struct MRCtx {
    * needs to unblock the client.
    */
   MRReduceFunc fn;
+
+  /* Folds replies into the result as they arrive, see MRCtx_SetReplyFold */
+  MRReplyFoldFunc fold;
+
+  /* Replies are kept in the slots of their commands, see MRCtx_SetOrderedReplies */
+  int ordered;
+  /* Set by MR_MapKeys, the command each key was sent with */
+  struct MRCmdRef *cmdRefs;
+  int *keyCmds;
+  int numKeys;
+
+  /* Room for a reply from every shard, allocated with the context. replies only moves out of it
+   * if more replies arrive */
+  MRReply *inlineReplies[];
 } MRCtx;
 
 /* The request duration in microsecnds, relevant only on the reducer */
@@ -72,39 +86,55 @@ void MR_SetCoordinationStrategy(MRCtx *ctx, MRCoordinationStrategy strategy) {
 static int totalAllocd = 0;
 /* Create a new MapReduce context */
 MRCtx *MR_CreateCtx(RedisModuleCtx *ctx, void *privdata) {
-  MRCtx *ret = malloc(sizeof(MRCtx));
+  int cap = MAX(1, MRCluster_NumShards(cluster_g));
+  MRCtx *ret = malloc(sizeof(MRCtx) + cap * sizeof(MRReply *));
   clock_gettime(CLOCK_REALTIME, &ret->startTime);
   ret->endTime = ret->startTime;
   ret->firstRespTime = ret->startTime;
   ret->numReplied = 0;
   ret->numErrored = 0;
   ret->numExpected = 0;
-  ret->repliesCap = MAX(1, MRCluster_NumShards(cluster_g));
-  ret->replies = calloc(ret->repliesCap, sizeof(redisReply *));
+  ret->repliesCap = cap;
+  ret->replies = ret->inlineReplies;
+  memset(ret->replies, 0, cap * sizeof(MRReply *));
   ret->reducer = NULL;
   ret->privdata = privdata;
   ret->strategy = MRCluster_FlatCoordination;
   ret->redisCtx = ctx;
   ret->fn = NULL;
+  ret->fold = NULL;
+  ret->ordered = 0;
+  ret->cmdRefs = NULL;
+  ret->keyCmds = NULL;
+  ret->numKeys = 0;
   totalAllocd++;
 
   return ret;
 }
 
+/* The number of reply slots the reducer gets */
+static inline int replyCount(MRCtx *ctx) {
+  return ctx->ordered ? ctx->numCmds : ctx->numReplied;
+}
+
 void MRCtx_Free(MRCtx *ctx) {
 
   for (int i = 0; i < ctx->numCmds; i++) {
     MRCommand_Free(&ctx->cmds[i]);
   }
   free(ctx->cmds);
+  free(ctx->cmdRefs);
+  free(ctx->keyCmds);
 
-  for (int i = 0; i < ctx->numReplied; i++) {
+  for (int i = 0; i < replyCount(ctx); i++) {
     if (ctx->replies[i] != NULL) {
       MRReply_Free(ctx->replies[i]);
       ctx->replies[i] = NULL;
     }
   }
-  free(ctx->replies);
+  if (ctx->replies != ctx->inlineReplies) {
+    free(ctx->replies);
+  }
 
   // free the context
   free(ctx);
@@ -131,10 +161,23 @@ int MRCtx_GetCmdsSize(struct MRCtx *ctx) {
   return ctx->numCmds;
 }
 
+const int *MRCtx_GetKeyCommands(struct MRCtx *ctx, int *numKeys) {
+  *numKeys = ctx->numKeys;
+  return ctx->keyCmds;
+}
+
 void MRCtx_SetReduceFunction(struct MRCtx *ctx, MRReduceFunc fn) {
   ctx->fn = fn;
 }
 
+void MRCtx_SetReplyFold(struct MRCtx *ctx, MRReplyFoldFunc fn) {
+  ctx->fold = fn;
+}
+
+void MRCtx_SetOrderedReplies(struct MRCtx *ctx) {
+  ctx->ordered = 1;
+}
+
 static void freePrivDataCB(void *p) {
   // printf("FreePrivData called!\n");
   MR_requestCompleted();
@@ -161,7 +204,23 @@ static int unblockHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
 
   mc->redisCtx = ctx;
 
-  return mc->reducer(mc, mc->numReplied, mc->replies);
+  return mc->reducer(mc, replyCount(mc), mc->replies);
+}
+
+/* Once the last reply arrived, reduce it on the event loop or unblock the client to reduce it */
+static void requestProgress(MRCtx *ctx) {
+  // printf("Unblocking, replied %d, errored %d out of %d\n", ctx->numReplied, ctx->numErrored,
+  //        ctx->numExpected);
+
+  // If we've received the last reply - unblock the client
+  if (ctx->numReplied + ctx->numErrored == ctx->numExpected) {
+    if (ctx->fn) {
+      ctx->fn(ctx, replyCount(ctx), ctx->replies);
+    } else {
+      RedisModuleBlockedClient *bc = ctx->redisCtx;
+      RedisModule_UnblockClient(bc, ctx);
+    }
+  }
 }
 
 /* The callback called from each fanout request to aggregate their replies */
@@ -179,24 +238,62 @@ static void fanoutCallback(redisAsyncContext *c, void *r, void *privdata) {
   } else {
     /* If needed - double the capacity for replies */
     if (ctx->numReplied == ctx->repliesCap) {
+      MRReply **replies = malloc(ctx->repliesCap * 2 * sizeof(MRReply *));
+      memcpy(replies, ctx->replies, ctx->repliesCap * sizeof(MRReply *));
+      if (ctx->replies != ctx->inlineReplies) {
+        free(ctx->replies);
+      }
+      ctx->replies = replies;
       ctx->repliesCap *= 2;
-      ctx->replies = realloc(ctx->replies, ctx->repliesCap * sizeof(MRReply *));
     }
-    ctx->replies[ctx->numReplied++] = r;
+    // folded replies are counted, but their slot is left empty
+    ctx->replies[ctx->numReplied++] = ctx->fold ? ctx->fold(ctx, r) : r;
   }
+  requestProgress(ctx);
+}
 
-  // printf("Unblocking, replied %d, errored %d out of %d\n", ctx->numReplied, ctx->numErrored,
-  //        ctx->numExpected);
+/* A command of an ordered request, passed to its callback to find the command's reply slot */
+struct MRCmdRef {
+  MRCtx *ctx;
+  int idx;
+};
 
-  // If we've received the last reply - unblock the client
-  if (ctx->numReplied + ctx->numErrored == ctx->numExpected) {
-    if (ctx->fn) {
-      ctx->fn(ctx, ctx->numReplied, ctx->replies);
-    } else {
-      RedisModuleBlockedClient *bc = ctx->redisCtx;
-      RedisModule_UnblockClient(bc, ctx);
+/* The callback of MR_MapKeys commands, which keeps each reply in the slot of its command */
+static void orderedCallback(redisAsyncContext *c, void *r, void *privdata) {
+  struct MRCmdRef *ref = privdata;
+  MRCtx *ctx = ref->ctx;
+  if (ctx->numReplied == 0 && ctx->numErrored == 0) {
+    clock_gettime(CLOCK_REALTIME, &ctx->firstRespTime);
+  }
+  if (!r) {
+    ctx->numErrored++;
+  } else {
+    ctx->replies[ref->idx] = r;
+    ctx->numReplied++;
+  }
+  requestProgress(ctx);
+}
+
+/* Send the commands of an ordered request, each with the slot its reply is kept in. Returns the
+ * number of commands sent */
+static int sendOrdered(MRCtx *mrctx) {
+  if (mrctx->numCmds > mrctx->repliesCap) {
+    if (mrctx->replies != mrctx->inlineReplies) {
+      free(mrctx->replies);
+    }
+    mrctx->replies = calloc(mrctx->numCmds, sizeof(MRReply *));
+    mrctx->repliesCap = mrctx->numCmds;
+  }
+  int sent = 0;
+  mrctx->cmdRefs = malloc(MAX(mrctx->numCmds, 1) * sizeof(*mrctx->cmdRefs));
+  for (int i = 0; i < mrctx->numCmds; i++) {
+    mrctx->cmdRefs[i] = (struct MRCmdRef){.ctx = mrctx, .idx = i};
+    if (MRCluster_SendCommand(cluster_g, mrctx->strategy, &mrctx->cmds[i], orderedCallback,
+                              &mrctx->cmdRefs[i]) == REDIS_OK) {
+      sent++;
     }
   }
+  return sent;
 }
 
 // temporary request context to pass to the event loop
@@ -205,6 +302,8 @@ struct MRRequestCtx {
   MRReduceFunc f;
   MRCommand *cmds;
   int numCmds;
+  // the first key argument of an MR_MapKeys command
+  int firstKey;
   void (*cb)(struct MRRequestCtx *);
 };
 
@@ -267,15 +366,15 @@ static void uvFanoutRequest(struct MRRequestCtx *mc) {
   }
 
   if (cluster_g->topo) {
-    MRCommand *cmd = &mc->cmds[0];
+    // send the context's own copy, it must outlive the request in case the command is retried
+    MRCommand *cmd = &mrctx->cmds[0];
     mrctx->numExpected =
         MRCluster_FanoutCommand(cluster_g, mrctx->strategy, cmd, fanoutCallback, mrctx);
   }
 
+  // nothing was sent, reduce the empty reply set right away
   if (mrctx->numExpected == 0) {
-    RedisModuleBlockedClient *bc = mrctx->redisCtx;
-    RedisModule_UnblockClient(bc, mrctx);
-    // printf("could not send single command. hande fail please\n");
+    requestProgress(mrctx);
   }
 
   free(mc->cmds);
@@ -294,18 +393,21 @@ static void uvMapRequest(struct MRRequestCtx *mc) {
     mrctx->cmds[i] = mc->cmds[i];
   }
 
-  for (int i = 0; i < mc->numCmds; i++) {
+  if (mrctx->ordered) {
+    mrctx->numExpected = sendOrdered(mrctx);
+  }
+  for (int i = 0; i < mc->numCmds && !mrctx->ordered; i++) {
 
-    if (MRCluster_SendCommand(cluster_g, mrctx->strategy, &mc->cmds[i], fanoutCallback, mrctx) ==
-        REDIS_OK) {
+    // send the context's own copy, it must outlive the request in case the command is retried
+    if (MRCluster_SendCommand(cluster_g, mrctx->strategy, &mrctx->cmds[i], fanoutCallback,
+                              mrctx) == REDIS_OK) {
       mrctx->numExpected++;
     }
   }
 
+  // nothing was sent, reduce the empty reply set right away
   if (mrctx->numExpected == 0) {
-    RedisModuleBlockedClient *bc = mrctx->redisCtx;
-    RedisModule_UnblockClient(bc, mrctx);
-    // printf("could not send single command. hande fail please\n");
+    requestProgress(mrctx);
   }
 
   free(mc->cmds);
@@ -368,6 +470,78 @@ int MR_Map(struct MRCtx *ctx, MRReduceFunc reducer, MRCommandGenerator cmds, boo
   return REDIS_OK;
 }
 
+/* Split an MR_MapKeys command by the shards that own its keys, and send it to them */
+static void uvMapKeysRequest(struct MRRequestCtx *mc) {
+  MRCtx *mrctx = mc->ctx;
+  MRCommand *cmd = &mc->cmds[0];
+  int numKeys = MAX(cmd->num - mc->firstKey, 0);
+  mrctx->numReplied = 0;
+  mrctx->reducer = mc->f;
+  mrctx->numExpected = 0;
+  mrctx->ordered = 1;
+  mrctx->numKeys = numKeys;
+  mrctx->keyCmds = malloc(MAX(numKeys, 1) * sizeof(*mrctx->keyCmds));
+  mrctx->numCmds = 0;
+  mrctx->cmds = calloc(MAX(numKeys, 1), sizeof(MRCommand));
+
+  // the arguments before the keys start the command of every shard
+  MRCommand prefix = MRCommand_Copy(cmd);
+  MRCommand_RemoveArgs(&prefix, mc->firstKey, numKeys);
+  size_t numShards = cluster_g->topo ? cluster_g->topo->numShards : 0;
+  int *shardCmds = malloc(MAX(numShards, 1) * sizeof(*shardCmds));
+  for (size_t i = 0; i < numShards; i++) {
+    shardCmds[i] = -1;
+  }
+  for (int k = 0; k < numKeys; k++) {
+    size_t len;
+    const char *key = MRCommand_ArgStringPtrLen(cmd, mc->firstKey + k, &len);
+    mr_slot_t slot;
+    MRClusterShard *sh = MRCluster_ShardForKey(cluster_g, key, len, &slot);
+    if (!sh) {
+      mrctx->keyCmds[k] = -1;
+      continue;
+    }
+    int *c = &shardCmds[sh - cluster_g->topo->shards];
+    if (*c < 0) {
+      *c = mrctx->numCmds++;
+      mrctx->cmds[*c] = MRCommand_Copy(&prefix);
+      mrctx->cmds[*c].targetSlot = slot;
+    }
+    MRCommand_AppendFrom(&mrctx->cmds[*c], cmd, mc->firstKey + k);
+    mrctx->keyCmds[k] = *c;
+  }
+  free(shardCmds);
+  MRCommand_Free(&prefix);
+  MRCommand_Free(cmd);
+
+  mrctx->numExpected = sendOrdered(mrctx);
+  if (mrctx->numExpected == 0) {
+    requestProgress(mrctx);
+  }
+
+  free(mc->cmds);
+  free(mc);
+}
+
+int MR_MapKeys(struct MRCtx *ctx, MRReduceFunc reducer, MRCommand cmd, int firstKey, bool block) {
+  struct MRRequestCtx *rc = malloc(sizeof(struct MRRequestCtx));
+  if (block) {
+    ctx->redisCtx = RedisModule_BlockClient(
+        ctx->redisCtx, unblockHandler, timeoutHandler,
+        redisMajorVesion < 5 ? (void (*)(RedisModuleCtx *, void *))freePrivDataCB : freePrivDataCB_V5,
+        timeout_g);
+  }
+  rc->ctx = ctx;
+  rc->f = reducer;
+  rc->cmds = calloc(1, sizeof(MRCommand));
+  rc->numCmds = 1;
+  rc->cmds[0] = cmd;
+  rc->firstKey = firstKey;
+  rc->cb = uvMapKeysRequest;
+  RQ_Push(rq_g, requestCb, rc);
+  return REDIS_OK;
+}
+
 int MR_MapSingle(struct MRCtx *ctx, MRReduceFunc reducer, MRCommand cmd) {
 
   struct MRRequestCtx *rc = malloc(sizeof(struct MRRequestCtx));
@@ -391,11 +565,58 @@ size_t MR_NumHosts() {
   return cluster_g ? MRCluster_NumHosts(cluster_g) : 0;
 }
 
+int MR_ShardForKey(const char *key, size_t len, int *slot) {
+  mr_slot_t s;
+  MRClusterShard *sh = MRCluster_ShardForKey(cluster_g, key, len, &s);
+  if (!sh) {
+    return -1;
+  }
+  *slot = s;
+  return sh - cluster_g->topo->shards;
+}
+
+/* Polling interval of the readiness check while connections to new nodes are being opened. It
+ * doubles after every failed check, up to the max interval */
+#define MR_READINESS_CHECK_INTERVAL_MS 10
+#define MR_READINESS_CHECK_MAX_INTERVAL_MS 1000
+
+/* Set once all the shards of the current topology are reachable */
+static volatile int ready_g = 0;
+static uv_timer_t readinessTimer_g;
+static int readinessTimerInit_g = 0;
+static uint64_t readinessInterval_g = MR_READINESS_CHECK_INTERVAL_MS;
+
+static void readinessCheckCB(uv_timer_t *timer) {
+  if (!MRCluster_IsReady(cluster_g)) {
+    ready_g = 0;
+    uv_timer_start(timer, readinessCheckCB, readinessInterval_g, 0);
+    readinessInterval_g = MIN(readinessInterval_g * 2, MR_READINESS_CHECK_MAX_INTERVAL_MS);
+    return;
+  }
+  if (!ready_g) {
+    RedisModule_Log(NULL, "notice", "Coordinator ready: all %zu shards are reachable",
+                    MRCluster_NumShards(cluster_g));
+  }
+  ready_g = 1;
+}
+
+int MR_IsReady() {
+  return ready_g;
+}
+
 void SetMyPartition(MRClusterTopology *ct, MRClusterShard *myShard);
 /* on-loop update topology request. This can't be done from the main thread */
 static void uvUpdateTopologyRequest(struct MRRequestCtx *mc) {
   MRCLuster_UpdateTopology(cluster_g, (MRClusterTopology *)mc->ctx);
   SetMyPartition((MRClusterTopology *)mc->ctx, cluster_g->myshard);
+
+  // the connections to new nodes are opened asynchronously, poll until they are all up
+  if (!readinessTimerInit_g) {
+    uv_timer_init(uv_default_loop(), &readinessTimer_g);
+    readinessTimerInit_g = 1;
+  }
+  readinessInterval_g = MR_READINESS_CHECK_INTERVAL_MS;
+  uv_timer_start(&readinessTimer_g, readinessCheckCB, 0, 0);
   RQ_Done(rq_g);
   // fprintf(stderr, "topo update: conc requests: %d\n", concurrentRequests_g);
   free(mc);
@@ -416,6 +637,38 @@ int MR_UpdateTopology(MRClusterTopology *newTopo) {
   return REDIS_OK;
 }
 
+/* A callback run periodically on the event loop, see MR_RunEvery */
+struct MRPeriodic {
+  uv_timer_t timer;
+  void (*fn)(void *);
+  void *privdata;
+  uint64_t intervalMS;
+};
+
+static void periodicCB(uv_timer_t *timer) {
+  struct MRPeriodic *p = timer->data;
+  p->fn(p->privdata);
+}
+
+static void uvRunEveryRequest(struct MRRequestCtx *mc) {
+  struct MRPeriodic *p = mc->ctx;
+  uv_timer_init(uv_default_loop(), &p->timer);
+  p->timer.data = p;
+  uv_timer_start(&p->timer, periodicCB, p->intervalMS, p->intervalMS);
+  RQ_Done(rq_g);
+  free(mc);
+}
+
+void MR_RunEvery(uint64_t intervalMS, void (*fn)(void *), void *privdata) {
+  // timers can only be started on the io thread
+  struct MRPeriodic *p = calloc(1, sizeof(*p));
+  *p = (struct MRPeriodic){.fn = fn, .privdata = privdata, .intervalMS = intervalMS};
+  struct MRRequestCtx *rc = calloc(1, sizeof(*rc));
+  rc->ctx = p;
+  rc->cb = uvRunEveryRequest;
+  RQ_Push(rq_g, requestCb, rc);
+}
+
 struct MRIteratorCallbackCtx;
 
 typedef int (*MRIteratorCallback)(struct MRIteratorCallbackCtx *ctx, MRReply *rep, MRCommand *cmd);
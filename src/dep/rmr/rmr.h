@@ -21,6 +21,11 @@ int MR_Map(struct MRCtx *ctx, MRReduceFunc reducer, MRCommandGenerator cmds, boo
 
 int MR_MapSingle(struct MRCtx *ctx, MRReduceFunc reducer, MRCommand cmd);
 
+/* Map a command over the shards that own its keys, which are its arguments from firstKey on.
+ * Every shard that owns some of them is sent the arguments before firstKey followed by its keys.
+ * Replies are ordered, see MRCtx_SetOrderedReplies */
+int MR_MapKeys(struct MRCtx *ctx, MRReduceFunc reducer, MRCommand cmd, int firstKey, bool block);
+
 void MR_SetCoordinationStrategy(struct MRCtx *ctx, MRCoordinationStrategy strategy);
 
 /* Initialize the MapReduce engine with a node provider */
@@ -29,9 +34,17 @@ void MR_Init(MRCluster *cl, long long timeoutMS);
 /* Set a new topology for the cluster */
 int MR_UpdateTopology(MRClusterTopology *newTopology);
 
+/* Call fn with privdata on the event loop thread every intervalMS milliseconds, for as long as the
+ * engine runs */
+void MR_RunEvery(uint64_t intervalMS, void (*fn)(void *), void *privdata);
+
 /* Get the current cluster topology */
 MRClusterTopology *MR_GetCurrentTopology();
 
+/* Return 1 once all the shards of the current topology are reachable, i.e. we have an open and
+ * authenticated connection to at least one node of each shard */
+int MR_IsReady();
+
 /* Return our current node as detected by cluster state calls */
 MRClusterNode *MR_GetMyNode();
 
@@ -45,7 +58,21 @@ struct RedisModuleCtx *MRCtx_GetRedisCtx(struct MRCtx *ctx);
 void MRCtx_SetRedisCtx(struct MRCtx *ctx, void* rctx);
 MRCommand *MRCtx_GetCmds(struct MRCtx *ctx);
 int MRCtx_GetCmdsSize(struct MRCtx *ctx);
+/* The command each key of an MR_MapKeys request was sent with, or -1 if it could not be routed.
+ * The keys of a command keep their relative order */
+const int *MRCtx_GetKeyCommands(struct MRCtx *ctx, int *numKeys);
+/* Reduce the replies with fn on the event loop, instead of unblocking the client to reduce them.
+ * fn is also called, with no replies, if none of the commands could be sent */
 void MRCtx_SetReduceFunction(struct MRCtx *ctx, MRReduceFunc fn);
+
+/* Called on the event loop with each reply as soon as it arrives. The function takes ownership of
+ * the reply, and returns it if the reducer still needs it, or NULL if it was consumed */
+typedef MRReply *(*MRReplyFoldFunc)(struct MRCtx *ctx, MRReply *reply);
+void MRCtx_SetReplyFold(struct MRCtx *ctx, MRReplyFoldFunc fn);
+
+/* Keep every reply in the slot of its command, NULL if the command failed, so the reducer gets a
+ * reply per command in the order of MRCtx_GetCmds. Replies can't be folded then */
+void MRCtx_SetOrderedReplies(struct MRCtx *ctx);
 void MR_requestCompleted();
 
 
@@ -82,4 +109,9 @@ void MRIterator_WaitDone(MRIterator *it);
 #endif
 
 size_t MR_NumHosts();
+
+/* The index of the shard a key is stored on in the current topology, or -1 if it is unknown. slot
+ * is set to the slot the key hashes to, to be used as a command's targetSlot. Must be called from
+ * the event loop thread, i.e. from a reduce function set with MRCtx_SetReduceFunction */
+int MR_ShardForKey(const char *key, size_t len, int *slot);
 #endif  //__LIBRMR_H__
@@ -112,12 +112,104 @@ void testClusterSharding() {
   // MRClust_Free(cl);
 }
 
+void testTopologySerialize() {
+  int n = 4;
+  const char *hosts[] = {"localhost:6379", "pass word@localhost:6389", "localhost:6399",
+                         "localhost:6409"};
+  MRClusterTopology *topo = getTopology(4096, n, hosts);
+  topo->hashFunc = MRHashFunc_CRC12;
+
+  sds s = MRClusterTopology_Serialize(topo);
+  MRClusterTopology *loaded = MRClusterTopology_Deserialize(s, sdslen(s));
+  mu_check(loaded != NULL);
+  mu_check(loaded->numShards == n);
+  mu_check(loaded->numSlots == 4096);
+  mu_check(loaded->hashFunc == MRHashFunc_CRC12);
+  mu_check(MRClusterTopology_IsValid(loaded));
+  for (int i = 0; i < n; i++) {
+    MRClusterShard *sh = &loaded->shards[i];
+    mu_check(sh->startSlot == topo->shards[i].startSlot);
+    mu_check(sh->endSlot == topo->shards[i].endSlot);
+    mu_check(sh->numNodes == 1);
+    mu_check(!strcmp(sh->nodes[0].id, hosts[i]));
+    mu_check(!strcmp(sh->nodes[0].endpoint.host, "localhost"));
+    mu_check(sh->nodes[0].endpoint.port == topo->shards[i].nodes[0].endpoint.port);
+    mu_check(sh->nodes[0].flags == MRNode_Master);
+  }
+  mu_check(!strcmp(loaded->shards[1].nodes[0].endpoint.auth, "pass word"));
+  mu_check(loaded->shards[0].nodes[0].endpoint.auth == NULL);
+
+  // truncated input is rejected
+  mu_check(MRClusterTopology_Deserialize(s, sdslen(s) / 2) == NULL);
+  mu_check(MRClusterTopology_Deserialize("foo", 3) == NULL);
+
+  sdsfree(s);
+  MRClusterTopology_Free(loaded);
+  MRClusterTopology_Free(topo);
+}
+
+static int parseRedirect(const char *err, int *isAsk, mr_slot_t *slot, const char **addr,
+                         size_t *addrLen) {
+  redisReply r = {.type = REDIS_REPLY_ERROR, .str = (char *)err, .len = strlen(err)};
+  return MRCluster_ParseRedirect((MRReply *)&r, isAsk, slot, addr, addrLen);
+}
+
+void testParseRedirect() {
+  int isAsk;
+  mr_slot_t slot;
+  const char *addr;
+  size_t len;
+
+  mu_check(parseRedirect("MOVED 3999 127.0.0.1:6381", &isAsk, &slot, &addr, &len));
+  mu_check(!isAsk);
+  mu_assert_int_eq(3999, slot);
+  mu_check(len == strlen("127.0.0.1:6381") && !strncmp(addr, "127.0.0.1:6381", len));
+
+  mu_check(parseRedirect("ASK 12 localhost:6379", &isAsk, &slot, &addr, &len));
+  mu_check(isAsk);
+  mu_assert_int_eq(12, slot);
+  mu_check(len == strlen("localhost:6379") && !strncmp(addr, "localhost:6379", len));
+
+  mu_check(!parseRedirect("TRYAGAIN Multiple keys request during rehashing of slot", &isAsk,
+                          &slot, &addr, &len));
+  mu_check(!parseRedirect("MOVED 12", &isAsk, &slot, &addr, &len));
+  mu_check(!parseRedirect("MOVED foo localhost:6379", &isAsk, &slot, &addr, &len));
+}
+
+static MRReplyRetryType retryType(const char *err, int attempts) {
+  redisReply r = {.type = REDIS_REPLY_ERROR, .str = (char *)err, .len = strlen(err)};
+  return MRCluster_RetryType((MRReply *)&r, attempts);
+}
+
+void testRetryType() {
+  mu_assert_int_eq(MRReply_Moved, retryType("MOVED 3999 127.0.0.1:6381", 0));
+  mu_assert_int_eq(MRReply_Ask, retryType("ASK 12 localhost:6379", 0));
+  mu_assert_int_eq(MRReply_TryAgain, retryType("TRYAGAIN Multiple keys request", 0));
+  mu_assert_int_eq(MRReply_TryAgain, retryType("CLUSTERDOWN The cluster is down", 0));
+  mu_assert_int_eq(MRReply_ConnLost, MRCluster_RetryType(NULL, 0));
+
+  // other errors and regular replies go to the caller
+  mu_assert_int_eq(MRReply_Final, retryType("ERR Unknown index name", 0));
+  mu_assert_int_eq(MRReply_Final, retryType("MOVE", 0));
+  redisReply ok = {.type = REDIS_REPLY_STATUS, .str = "OK", .len = 2};
+  mu_assert_int_eq(MRReply_Final, MRCluster_RetryType((MRReply *)&ok, 0));
+
+  // the retry budget
+  mu_assert_int_eq(MRReply_Moved, retryType("MOVED 1 localhost:6379", MRCLUSTER_MAX_RETRIES - 1));
+  mu_assert_int_eq(MRReply_Final, retryType("MOVED 1 localhost:6379", MRCLUSTER_MAX_RETRIES));
+  mu_assert_int_eq(MRReply_Final, retryType("TRYAGAIN", MRCLUSTER_MAX_RETRIES));
+  mu_assert_int_eq(MRReply_Final, MRCluster_RetryType(NULL, MRCLUSTER_MAX_RETRIES));
+}
+
 int main(int argc, char **argv) {
   RMUTil_InitAlloc();
   MU_RUN_TEST(testEndpoint);
   MU_RUN_TEST(testShardingFunc);
   MU_RUN_TEST(testCluster);
   MU_RUN_TEST(testClusterSharding);
+  MU_RUN_TEST(testParseRedirect);
+  MU_RUN_TEST(testRetryType);
+  MU_RUN_TEST(testTopologySerialize);
   MU_REPORT();
 
   return minunit_status;
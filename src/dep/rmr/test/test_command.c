@@ -1,7 +1,114 @@
 #include <stdio.h>
+#include <string.h>
 #include "minunit.h"
 #include <command.h>
+#include <hiredis/hiredis.h>
+
+void testCommandTemplate() {
+  MRCommand cmd = MR_NewCommand(5, "_FT.SEARCH", "idx", "hello world", "LIMIT", "0");
+  MRCommandTemplate t;
+  MRCommandTemplate_Init(&t, &cmd, 1);
+
+  // patching the index name must produce the same RESP as formatting the tagged command
+  MRCommand_ReplaceArg(&cmd, 1, "idx{06S}", strlen("idx{06S}"));
+  sds expected = NULL;
+  mu_check(redisFormatSdsCommandArgv(&expected, cmd.num, (const char **)cmd.strs, cmd.lens) > 0);
+  sds patched = MRCommandTemplate_Format(&t, "idx{06S}", strlen("idx{06S}"));
+  mu_check(sdslen(patched) == sdslen(expected));
+  mu_check(!memcmp(patched, expected, sdslen(expected)));
+
+  // modifying the command drops its cached serialized form
+  cmd.cmd = patched;
+  MRCommand_AppendArgs(&cmd, 1, "WITHSCORES");
+  mu_check(cmd.cmd == NULL);
+
+  sdsfree(expected);
+  MRCommandTemplate_Free(&t);
+  MRCommand_Free(&cmd);
+}
+
+void testCommandArgs() {
+  MRCommand cmd = MR_NewCommand(5, "FT.SEARCH", "idx", "hello", "LIMIT", "10");
+  MRCommand_ReplaceArg(&cmd, 0, "_FT.SEARCH", strlen("_FT.SEARCH"));
+  mu_check(MRCommand_GetFlags(&cmd) & MRCommand_Idempotent);
+
+  // inserted arguments shift the rest of the command, including their ownership
+  char *owned = strdup("idx{06S}");
+  MRCommand_ReplaceArgNoDup(&cmd, 1, owned, strlen(owned));
+  MRCommand_AppendArgsAtPos(&cmd, 1, 1, "WITHSCORES");
+  MRCommand_AppendArgsAtPos(&cmd, 1, 1, "WITHSORTKEYS");
+  mu_check(cmd.num == 7);
+  mu_check(cmd.strs[3] == owned);
+  mu_check(cmd.argFlags[3] & MRCommandArg_Owned);
+  mu_check(!strcmp(cmd.strs[1], "WITHSORTKEYS"));
+  mu_check(!strcmp(cmd.strs[6], "10"));
+
+  // a copy owns all of its arguments in its own arena
+  MRCommand cp = MRCommand_Copy(&cmd);
+  MRCommand_Free(&cmd);
+  mu_check(cp.num == 7);
+  for (int i = 0; i < cp.num; i++) {
+    mu_check(!(cp.argFlags[i] & MRCommandArg_Owned));
+  }
+  mu_check(!strcmp(cp.strs[3], "idx{06S}"));
+  mu_check(cp.lens[3] == strlen("idx{06S}"));
+  mu_check(!strcmp(cp.strs[6], "10"));
+
+  // removed arguments are released and the rest shifts into their place
+  MRCommand_RemoveArgs(&cp, 1, 2);
+  mu_check(cp.num == 5);
+  mu_check(!strcmp(cp.strs[1], "idx{06S}"));
+  mu_check(!strcmp(cp.strs[4], "10"));
+  MRCommand_RemoveArgs(&cp, 4, 2);
+  mu_check(cp.num == 5);
+  MRCommand_Free(&cp);
+}
+
+void testCommandConf() {
+  MRCommand cmd = MR_NewCommand(3, "ft.search", "idx", "hello");
+  mu_check(cmd.id >= 0);
+  mu_check(MRCommand_GetFlags(&cmd) & MRCommand_Coordination);
+
+  // the prefix rewrite lands on the internal command's configuration
+  MRCommand_SetPrefix(&cmd, "_FT");
+  mu_check(!strcmp(cmd.strs[0], "_FT.search"));
+  MRCommand other = MR_NewCommand(1, "_FT.SEARCH");
+  mu_check(cmd.id == other.id);
+  mu_check(MRCommand_GetFlags(&cmd) & MRCommand_Idempotent);
+
+  // commands without a configuration fall back to the defaults
+  MRCommand_ReplaceArg(&other, 0, "NOSUCHCMD", strlen("NOSUCHCMD"));
+  mu_check(other.id == -1);
+  mu_check(MRCommand_GetShardingKey(&other) == 1);
+
+  MRCommand_Free(&cmd);
+  MRCommand_Free(&other);
+}
+
+void testCommandCopyBorrowed() {
+  // an argument borrowed from a string the command doesn't own, as MR_NewCommandBorrowingStrings
+  // makes them
+  char borrowed[] = "hello";
+  MRCommand cmd = MR_NewCommand(3, "_FT.SEARCH", "idx", "x");
+  cmd.strs[2] = borrowed;
+  cmd.lens[2] = strlen(borrowed);
+  cmd.argFlags[2] = MRCommandArg_Borrowed;
+
+  // once copied the command no longer depends on the string
+  MRCommand_CopyBorrowed(&cmd);
+  borrowed[0] = 'j';
+  mu_check(!strcmp(cmd.strs[2], "hello"));
+  mu_check(cmd.lens[2] == strlen("hello"));
+  mu_check(cmd.argFlags[2] == 0);
+  mu_check(!strcmp(cmd.strs[1], "idx"));
+  MRCommand_Free(&cmd);
+}
 
 int main() {
-  printf("Hello!\n");
-}
\ No newline at end of file
+  MU_RUN_TEST(testCommandTemplate);
+  MU_RUN_TEST(testCommandArgs);
+  MU_RUN_TEST(testCommandConf);
+  MU_RUN_TEST(testCommandCopyBorrowed);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -1,6 +1,9 @@
 #include "minunit.h"
 #include <redise_parser/parse.h>
 #include <cluster.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 void testParser() {
   const char *q =
@@ -142,9 +145,120 @@ void testHashFunc() {
 
   // Test error
 }
+/* Split a topology request on spaces, the way redis would pass it to CLUSTERSET as argv */
+static int splitArgs(char *q, const char **args, size_t *lens, int cap) {
+  int n = 0;
+  for (char *tok = strtok(q, " "); tok && n < cap; tok = strtok(NULL, " ")) {
+    args[n] = tok;
+    lens[n++] = strlen(tok);
+  }
+  return n;
+}
+
+void testArgvParser() {
+  char q[] = "MYID 1 HASREPLICATION HASHFUNC CRC16 NUMSLOTS 1337 RANGES 2 SHARD 1 SLOTRANGE 0 2047 "
+             "ADDR pass@10.0.1.7:20293 UNIXADDR unix:/tmp/redis-1.sock MASTER SHARD 2 SLOTRANGE 0 "
+             "2047 ADDR pass@10.0.1.50:20293 SHARD 3 SLOTRANGE 2048 4095 ADDR pass@10.0.1.7:27262 "
+             "master SHARD 4 SLOTRANGE 2048 4095 ADDR pass@10.0.1.50:27262";
+  const char *args[64];
+  size_t lens[64];
+  int n = splitArgs(q, args, lens, 64);
+
+  char *err = NULL;
+  MRClusterTopology *topo = MR_ParseTopologyArgv(args, lens, n, &err);
+  if (err != NULL) {
+    mu_fail(err);
+  }
+  mu_check(topo != NULL);
+  mu_check(topo->numShards == 2);
+  mu_check(topo->numSlots == 1337);
+  mu_check(topo->hashFunc == MRHashFunc_CRC16);
+  mu_check(topo->shards[0].numNodes == 2);
+  mu_check(topo->shards[1].startSlot == 2048);
+  mu_check(!strcmp(topo->shards[0].nodes[0].id, "1"));
+  mu_check(!strcmp(topo->shards[0].nodes[0].endpoint.host, "10.0.1.7"));
+  mu_check(!strcmp(topo->shards[0].nodes[0].endpoint.auth, "pass"));
+  mu_check(!strcmp(topo->shards[0].nodes[0].endpoint.unixSock, "unix:/tmp/redis-1.sock"));
+  mu_check(topo->shards[0].nodes[0].flags == (MRNode_Coordinator | MRNode_Master | MRNode_Self));
+  // keywords are case insensitive, like in the lexer
+  mu_check(topo->shards[1].nodes[0].flags == (MRNode_Coordinator | MRNode_Master));
+  mu_check(topo->shards[1].nodes[1].endpoint.port == 27262);
+  MRClusterTopology_Free(topo);
+
+  char bad[] = "foo bar baz";
+  n = splitArgs(bad, args, lens, 64);
+  err = NULL;
+  topo = MR_ParseTopologyArgv(args, lens, n, &err);
+  mu_check(topo == NULL);
+  mu_check(err != NULL);
+  free(err);
+}
+
+static double elapsedMS(struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* Compare the argv parser with joining and re-lexing, on a 1000 shard topology with a replica per
+ * shard. Only run when RMR_BENCHMARK is set */
+void testParserBenchmark() {
+  const int numShards = 1000, iterations = 100;
+  sds q = sdscatprintf(sdsempty(), "MYID 1 HASREPLICATION HASHFUNC CRC16 NUMSLOTS 16384 RANGES %d",
+                       numShards);
+  for (int i = 0; i < numShards; i++) {
+    int start = i * 16384 / numShards, end = (i + 1) * 16384 / numShards - 1;
+    for (int r = 0; r < 2; r++) {
+      int id = i * 2 + r + 1;
+      q = sdscatprintf(q,
+                       " SHARD %d SLOTRANGE %d %d ADDR password@10.0.%d.%d:%d UNIXADDR "
+                       "unix:/tmp/redis-%d.sock%s",
+                       id, start, end, id / 250, id % 250, 20000 + id, id, r ? "" : " MASTER");
+    }
+  }
+  size_t qlen = sdslen(q);
+
+  // split a copy into arguments, the way CLUSTERSET gets them
+  sds qargs = sdsdup(q);
+  int cap = numShards * 2 * 10 + 16;
+  const char **args = malloc(cap * sizeof(*args));
+  size_t *lens = malloc(cap * sizeof(*lens));
+  int n = splitArgs(qargs, args, lens, cap);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < iterations; i++) {
+    MRClusterTopology *topo = MR_ParseTopologyRequest(q, qlen, NULL);
+    mu_check(topo && topo->numShards == numShards);
+    MRClusterTopology_Free(topo);
+  }
+  double lexMS = elapsedMS(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < iterations; i++) {
+    MRClusterTopology *topo = MR_ParseTopologyArgv(args, lens, n, NULL);
+    mu_check(topo && topo->numShards == numShards);
+    mu_check(topo->shards[numShards - 1].numNodes == 2);
+    MRClusterTopology_Free(topo);
+  }
+  double argvMS = elapsedMS(&start);
+
+  printf("Parsing a %d shard topology (%d args): lexer %.3fms, argv %.3fms per update\n", numShards,
+         n, lexMS / iterations, argvMS / iterations);
+
+  free(args);
+  free(lens);
+  sdsfree(qargs);
+  sdsfree(q);
+}
+
 int main(int argc, char **argv) {
   MU_RUN_TEST(testParser);
   MU_RUN_TEST(testHashFunc);
+  MU_RUN_TEST(testArgvParser);
+  if (getenv("RMR_BENCHMARK")) {
+    MU_RUN_TEST(testParserBenchmark);
+  }
 
   MU_REPORT();
 
@@ -0,0 +1,292 @@
+#include <string.h>
+#include <math.h>
+#include "minunit.h"
+#include <reply.h>
+#include <hiredis/hiredis.h>
+#include <lz4.h>
+#include <fast_float.h>
+
+static MRReply *readReplyLenWithModes(const char *resp, size_t len, MRReplyModeQueue *modes) {
+  redisReader *r = redisReaderCreateWithFunctions(&MRReply_ArenaFunctions);
+  r->privdata = modes;
+  redisReaderFeed(r, resp, len);
+  void *reply = NULL;
+  int rc = redisReaderGetReply(r, &reply);
+  redisReaderFree(r);
+  return rc == REDIS_OK ? reply : NULL;
+}
+
+static MRReply *readReplyWithModes(const char *resp, MRReplyModeQueue *modes) {
+  return readReplyLenWithModes(resp, strlen(resp), modes);
+}
+
+static MRReply *readReply(const char *resp) {
+  return readReplyWithModes(resp, NULL);
+}
+
+void testArenaReply() {
+  // a search style reply: a count and a few nested rows
+  const char *resp = "*4\r\n:2\r\n$4\r\ndoc1\r\n*2\r\n$5\r\ntitle\r\n$5\r\nhello\r\n$-1\r\n";
+  MRReply *r = readReply(resp);
+  mu_check(r != NULL);
+  mu_assert_int_eq(MR_REPLY_ARRAY, MRReply_Type(r));
+  mu_assert_int_eq(4, MRReply_Length(r));
+  mu_assert_int_eq(2, MRReply_Integer(MRReply_ArrayElement(r, 0)));
+  mu_check(MRReply_StringEquals(MRReply_ArrayElement(r, 1), "doc1", 1));
+
+  MRReply *fields = MRReply_ArrayElement(r, 2);
+  mu_assert_int_eq(2, MRReply_Length(fields));
+  size_t len;
+  const char *s = MRReply_String(MRReply_ArrayElement(fields, 1), &len);
+  mu_assert_int_eq(5, len);
+  mu_check(!strcmp(s, "hello"));
+  mu_assert_int_eq(MR_REPLY_NIL, MRReply_Type(MRReply_ArrayElement(r, 3)));
+  MRReply_Free(r);
+
+  // large replies spill over into more arena chunks
+  sds big = sdsnew("*1000\r\n");
+  for (int i = 0; i < 1000; i++) {
+    big = sdscatfmt(big, "$9\r\nvalue%i\r\n", 1000 + i);
+  }
+  r = readReply(big);
+  mu_check(r != NULL);
+  mu_assert_int_eq(1000, MRReply_Length(r));
+  mu_check(MRReply_StringEquals(MRReply_ArrayElement(r, 999), "value1999", 1));
+  MRReply_Free(r);
+  sdsfree(big);
+
+  r = readReply("-ERR oops\r\n");
+  mu_assert_int_eq(MR_REPLY_ERROR, MRReply_Type(r));
+  mu_check(!strcmp(MRReply_String(r, NULL), "ERR oops"));
+  MRReply_Free(r);
+}
+
+void testLazyReply() {
+  MRReplyModeQueue modes = {0};
+  MRReplyModeQueue_Push(&modes, 1);
+  MRReplyModeQueue_Push(&modes, 0);
+
+  // two search results, the second with a nested array among its fields
+  const char *resp = "*5\r\n:2\r\n$4\r\ndoc1\r\n*2\r\n$5\r\ntitle\r\n$5\r\nhello\r\n"
+                     "$4\r\ndoc2\r\n*3\r\n:7\r\n*2\r\n$1\r\na\r\n$-1\r\n$2\r\nbb\r\n";
+  MRReply *r = readReplyWithModes(resp, &modes);
+  mu_check(r != NULL);
+  mu_assert_int_eq(1, modes.len);
+  mu_assert_int_eq(5, MRReply_Length(r));
+  mu_check(MRReply_StringEquals(MRReply_ArrayElement(r, 3), "doc2", 1));
+
+  // the fields are only parsed when accessed
+  MRReply *fields = MRReply_ArrayElement(r, 4);
+  mu_assert_int_eq(MR_REPLY_ARRAY, MRReply_Type(fields));
+  mu_assert_int_eq(3, MRReply_Length(fields));
+  mu_check(fields->element == NULL);
+  mu_assert_int_eq(7, MRReply_Integer(MRReply_ArrayElement(fields, 0)));
+  MRReply *nested = MRReply_ArrayElement(fields, 1);
+  mu_assert_int_eq(2, MRReply_Length(nested));
+  mu_check(MRReply_StringEquals(MRReply_ArrayElement(nested, 0), "a", 1));
+  mu_assert_int_eq(MR_REPLY_NIL, MRReply_Type(MRReply_ArrayElement(nested, 1)));
+  mu_check(MRReply_StringEquals(MRReply_ArrayElement(fields, 2), "bb", 1));
+
+  fields = MRReply_ArrayElement(r, 2);
+  mu_check(MRReply_StringEquals(MRReply_ArrayElement(fields, 1), "hello", 1));
+  MRReply_Free(r);
+
+  // the next reply on the connection is parsed eagerly
+  r = readReplyWithModes("*1\r\n*1\r\n:1\r\n", &modes);
+  mu_check(MRReply_ArrayElement(r, 0)->element != NULL);
+  MRReply_Free(r);
+  MRReplyModeQueue_Free(&modes);
+}
+
+void testResp3Reply() {
+  const char *resp = "*4\r\n,1.5\r\n#t\r\n%2\r\n$1\r\na\r\n:1\r\n$1\r\nb\r\n,-2\r\n"
+                     "~2\r\n$1\r\nx\r\n$1\r\ny\r\n";
+  MRReply *r = readReply(resp);
+  mu_check(r != NULL);
+
+  double d = 0;
+  mu_assert_int_eq(MR_REPLY_DOUBLE, MRReply_Type(MRReply_ArrayElement(r, 0)));
+  mu_check(MRReply_ToDouble(MRReply_ArrayElement(r, 0), &d));
+  mu_check(d == 1.5);
+  long long i = 0;
+  mu_check(MRReply_ToInteger(MRReply_ArrayElement(r, 1), &i));
+  mu_assert_int_eq(1, i);
+
+  // maps keep their keys and values flattened
+  MRReply *map = MRReply_ArrayElement(r, 2);
+  mu_assert_int_eq(MR_REPLY_MAP, MRReply_Type(map));
+  mu_assert_int_eq(4, MRReply_Length(map));
+  mu_check(MRReply_StringEquals(MRReply_ArrayElement(map, 2), "b", 1));
+  mu_check(MRReply_Double(MRReply_ArrayElement(map, 3)) == -2);
+
+  // sets are read as arrays
+  mu_assert_int_eq(MR_REPLY_ARRAY, MRReply_Type(MRReply_ArrayElement(r, 3)));
+  MRReply_Free(r);
+}
+
+// "*2\r\n$3\r\nabc\r\n$3\r\nabc\r\n", with the second "$3\r\n" as a match
+static const char lz4Block_g[] = "\xd0*2\r\n$3\r\nabc\r\n\x09\x00\x50" "abc\r\n";
+
+void testLz4() {
+  char out[64];
+  mu_assert_int_eq(22, lz4_decompress(lz4Block_g, sizeof(lz4Block_g) - 1, out, sizeof(out)));
+  mu_check(!memcmp(out, "*2\r\n$3\r\nabc\r\n$3\r\nabc\r\n", 22));
+
+  // a match overlapping its own output, with an extended length
+  const char rle[] = "\xaf*1\r\n$20\r\na\x01\x00\x00\x20\r\n";
+  mu_assert_int_eq(31, lz4_decompress(rle, sizeof(rle) - 1, out, sizeof(out)));
+  mu_check(!memcmp(out, "*1\r\n$20\r\naaaaaaaaaaaaaaaaaaaa\r\n", 31));
+
+  // output that does not fit, truncated input and bad offsets are rejected
+  mu_assert_int_eq(-1, lz4_decompress(lz4Block_g, sizeof(lz4Block_g) - 1, out, 21));
+  mu_assert_int_eq(-1, lz4_decompress(lz4Block_g, 10, out, sizeof(out)));
+  mu_assert_int_eq(-1, lz4_decompress("\x10x\x05\x00", 4, out, sizeof(out)));
+}
+
+void testFastFloat() {
+  double d;
+  mu_assert_int_eq(4, fast_strtod("1.25", 4, &d));
+  mu_check(d == 1.25);
+  mu_assert_int_eq(19, fast_strtod("0.12345678901234568", 19, &d));
+  mu_check(d == 0.12345678901234568);
+  mu_assert_int_eq(8, fast_strtod("-3.5e-40", 8, &d));
+  mu_check(d == -3.5e-40);
+  mu_assert_int_eq(2, fast_strtod("-0", 2, &d));
+  mu_check(d == 0 && signbit(d));
+
+  // stops where strtod would, and leaves what it can't round exactly to strtod
+  mu_assert_int_eq(1, fast_strtod("7e", 2, &d));
+  mu_check(d == 7);
+  mu_assert_int_eq(0, fast_strtod("0x10", 4, &d));
+  mu_assert_int_eq(0, fast_strtod("inf", 3, &d));
+  mu_assert_int_eq(0, fast_strtod("1e400", 5, &d));
+  mu_assert_int_eq(0, fast_strtod("12345678901234567890", 20, &d));
+
+  // replies still parse through the strtod fallback
+  MRReply *r = readReply("+1e400\r\n");
+  mu_check(MRReply_ToDouble(r, &d) == 0);
+  MRReply_Free(r);
+  r = readReply("$21\r\n123456789012345678901\r\n");
+  mu_check(MRReply_ToDouble(r, &d) && d == 123456789012345678901.0);
+  MRReply_Free(r);
+}
+
+static sds compressedFrame(const char *block, size_t len, uint32_t size) {
+  sds resp = sdscatfmt(sdsempty(), "$%u\r\n", (unsigned)(MRREPLY_LZ4_HEADER_SIZE + len));
+  resp = sdscatlen(resp, MRREPLY_LZ4_MAGIC, 4);
+  resp = sdscatlen(resp, &size, sizeof(size));
+  resp = sdscatlen(resp, block, len);
+  return sdscatlen(resp, "\r\n", 2);
+}
+
+void testCompressedReply() {
+  sds resp = compressedFrame(lz4Block_g, sizeof(lz4Block_g) - 1, 22);
+  MRReplyCompressionStats before = MRReply_GetCompressionStats();
+
+  // the frame is only a bulk string on connections that did not negotiate compression
+  MRReply *r = readReplyLenWithModes(resp, sdslen(resp), NULL);
+  mu_assert_int_eq(MR_REPLY_STRING, MRReply_Type(r));
+  MRReply_Free(r);
+
+  MRReplyModeQueue modes = {0};
+  MRReplyModeQueue_Push(&modes, MRREPLY_MODE_COMPRESSED | MRREPLY_MODE_LAZY);
+  MRReplyModeQueue_Push(&modes, MRREPLY_MODE_COMPRESSED);
+  r = readReplyLenWithModes(resp, sdslen(resp), &modes);
+  mu_assert_int_eq(1, modes.len);
+  mu_assert_int_eq(MR_REPLY_ARRAY, MRReply_Type(r));
+  mu_assert_int_eq(2, MRReply_Length(r));
+  mu_check(MRReply_StringEquals(MRReply_ArrayElement(r, 1), "abc", 1));
+  MRReply_Free(r);
+
+  MRReplyCompressionStats after = MRReply_GetCompressionStats();
+  mu_assert_int_eq(1, after.numReplies - before.numReplies);
+  mu_assert_int_eq(22, after.inflatedBytes - before.inflatedBytes);
+  sdsfree(resp);
+
+  // a frame that does not decompress to its size is turned into an error
+  resp = compressedFrame(lz4Block_g, sizeof(lz4Block_g) - 1, 30);
+  r = readReplyLenWithModes(resp, sdslen(resp), &modes);
+  mu_assert_int_eq(MR_REPLY_ERROR, MRReply_Type(r));
+  MRReply_Free(r);
+  sdsfree(resp);
+
+  // and so is a frame whose size is more than the block could expand to
+  MRReplyModeQueue_Push(&modes, MRREPLY_MODE_COMPRESSED);
+  resp = compressedFrame(lz4Block_g, sizeof(lz4Block_g) - 1, UINT32_MAX);
+  r = readReplyLenWithModes(resp, sdslen(resp), &modes);
+  mu_assert_int_eq(MR_REPLY_ERROR, MRReply_Type(r));
+  MRReply_Free(r);
+  sdsfree(resp);
+  MRReplyModeQueue_Free(&modes);
+}
+
+// the relayed reply is recorded as text instead of being sent to a client
+static sds relayed_g;
+
+static int recordArray(RedisModuleCtx *ctx, long len) {
+  relayed_g = sdscatfmt(relayed_g, "[%I ", (long long)len);
+  return REDISMODULE_OK;
+}
+static int recordLongLong(RedisModuleCtx *ctx, long long ll) {
+  relayed_g = sdscatfmt(relayed_g, "%I ", ll);
+  return REDISMODULE_OK;
+}
+static int recordBuffer(RedisModuleCtx *ctx, const char *s, size_t len) {
+  relayed_g = sdscatlen(sdscatlen(relayed_g, s, len), " ", 1);
+  return REDISMODULE_OK;
+}
+static int recordString(RedisModuleCtx *ctx, const char *s) {
+  relayed_g = sdscatfmt(relayed_g, "+%s ", s);
+  return REDISMODULE_OK;
+}
+static int recordNull(RedisModuleCtx *ctx) {
+  relayed_g = sdscat(relayed_g, "nil ");
+  return REDISMODULE_OK;
+}
+
+static sds relay(MRReply *r) {
+  relayed_g = sdsempty();
+  MR_ReplyWithMRReply(NULL, r);
+  return relayed_g;
+}
+
+void testRelayLazyReply() {
+  RedisModule_ReplyWithArray = recordArray;
+  RedisModule_ReplyWithLongLong = recordLongLong;
+  RedisModule_ReplyWithStringBuffer = recordBuffer;
+  RedisModule_ReplyWithSimpleString = recordString;
+  RedisModule_ReplyWithError = recordString;
+  RedisModule_ReplyWithNull = recordNull;
+
+  const char *resp = "*3\r\n$4\r\ndoc1\r\n*4\r\n$1\r\na\r\n*2\r\n:1\r\n+OK\r\n$-1\r\n*0\r\n"
+                     "*1\r\n-ERR x\r\n";
+  MRReplyModeQueue modes = {0};
+  MRReplyModeQueue_Push(&modes, 1);
+  MRReply *lazy = readReplyWithModes(resp, &modes);
+  MRReply *eager = readReply(resp);
+
+  // relaying straight from the encoded arrays emits the same reply
+  sds fromEncoded = relay(lazy);
+  mu_check(MRReply_ArrayElement(lazy, 1)->element == NULL);
+  sds fromParsed = relay(eager);
+  mu_check(!strcmp(fromEncoded, fromParsed));
+  mu_check(!strcmp(fromParsed, "[3 doc1 [4 a [2 1 +OK nil [0 [1 +ERR x "));
+
+  sdsfree(fromEncoded);
+  sdsfree(fromParsed);
+  MRReply_Free(lazy);
+  MRReply_Free(eager);
+  MRReplyModeQueue_Free(&modes);
+}
+
+int main() {
+  MU_RUN_TEST(testArenaReply);
+  MU_RUN_TEST(testLazyReply);
+  MU_RUN_TEST(testResp3Reply);
+  MU_RUN_TEST(testLz4);
+  MU_RUN_TEST(testFastFloat);
+  MU_RUN_TEST(testCompressedReply);
+  MU_RUN_TEST(testRelayLazyReply);
+  MU_REPORT();
+  return minunit_status;
+}
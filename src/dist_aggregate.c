@@ -2,6 +2,7 @@
 #include "dep/rmr/rmr.h"
 #include "dep/rmutil/util.h"
 #include "search_cluster.h"
+#include "config.h"
 #include "commands.h"
 #include "aggregate/aggregate.h"
 #include "dist_plan.h"
@@ -98,9 +99,14 @@ RSValue *MRReply_ToValue(MRReply *r) {
       break;
     }
     case MR_REPLY_INTEGER:
+    case MR_REPLY_BOOL:
       v = RS_NumVal((double)MRReply_Integer(r));
       break;
-    case MR_REPLY_ARRAY: {
+    case MR_REPLY_DOUBLE:
+      v = RS_NumVal(MRReply_Double(r));
+      break;
+    case MR_REPLY_ARRAY:
+    case MR_REPLY_MAP: {
       RSValue **arr = rm_calloc(MRReply_Length(r), sizeof(*arr));
       for (size_t i = 0; i < MRReply_Length(r); i++) {
         arr[i] = MRReply_ToValue(MRReply_ArrayElement(r, i));
@@ -125,6 +131,10 @@ typedef struct {
   // Lookup - the rows are written in here
   RLookup *lookup;
   size_t curIdx;
+  // Packed rows: the keys of the current chunk's columns, in order
+  int packedRows;
+  const RLookupKey **columns;
+  size_t numColumns;
   MRIterator *it;
   MRCommand cmd;
   MRCommandGenerator cg;
@@ -156,6 +166,104 @@ static int getNextReply(RPNet *nc) {
   }
 }
 
+/* In packed mode the shard replies with [total, [name, ...], row, ...], where every row is a
+ * single bulk string holding the values of all columns in order. Each value is a tag byte
+ * followed by its payload, with integers and doubles in little-endian byte order:
+ *    'n'                               - null
+ *    'd' <double>                      - number
+ *    's' <uint32 len> <bytes>          - string
+ *    'a' <uint32 count> <values...>    - array
+ * The column names are sent once per chunk, and are omitted when a chunk has no rows. Arrays may
+ * be nested up to PACKED_MAX_DEPTH levels. */
+#define PACKED_ROWS_FIRST 2
+#define PACKED_MAX_DEPTH 16
+
+static uint64_t loadLE(const char *p, size_t size) {
+  uint64_t x = 0;
+  for (size_t i = size; i > 0; i--) {
+    x = (x << 8) | (unsigned char)p[i - 1];
+  }
+  return x;
+}
+
+static const char *decodePackedValue(const char *p, const char *end, RSValue **v, int depth) {
+  uint32_t n;
+  if (p == end) return NULL;
+  switch (*p++) {
+    case 'n':
+      *v = RS_NullVal();
+      return p;
+    case 'd': {
+      double d;
+      if ((size_t)(end - p) < sizeof(d)) return NULL;
+      uint64_t bits = loadLE(p, sizeof(bits));
+      memcpy(&d, &bits, sizeof(d));
+      *v = RS_NumVal(d);
+      return p + sizeof(d);
+    }
+    case 's':
+      if ((size_t)(end - p) < sizeof(n)) return NULL;
+      n = loadLE(p, sizeof(n));
+      p += sizeof(n);
+      if ((size_t)(end - p) < n) return NULL;
+      *v = RS_NewCopiedString(p, n);
+      return p + n;
+    case 'a': {
+      if (depth == PACKED_MAX_DEPTH || (size_t)(end - p) < sizeof(n)) return NULL;
+      n = loadLE(p, sizeof(n));
+      p += sizeof(n);
+      // every element takes at least its tag byte
+      if ((size_t)(end - p) < n) return NULL;
+      RSValue **arr = rm_calloc(n, sizeof(*arr));
+      for (uint32_t i = 0; i < n; i++) {
+        if (p) p = decodePackedValue(p, end, &arr[i], depth + 1);
+        if (!p) arr[i] = RS_NullVal();
+      }
+      *v = RSValue_NewArrayEx(arr, n, RSVAL_ARRAY_ALLOC | RSVAL_ARRAY_NOINCREF);
+      if (!p) RSValue_Decref(*v);
+      return p;
+    }
+    default:
+      return NULL;
+  }
+}
+
+/* Resolve the column names of a packed chunk to lookup keys, once for all of its rows */
+static void resolvePackedColumns(RPNet *nc) {
+  MRReply *names = MRReply_ArrayElement(nc->current.rows, 1);
+  nc->numColumns = 0;
+  if (!names || MRReply_Type(names) != MR_REPLY_ARRAY) return;
+
+  nc->columns = rm_realloc(nc->columns, MRReply_Length(names) * sizeof(*nc->columns));
+  for (size_t i = 0; i < MRReply_Length(names); i++) {
+    const char *name = MRReply_String(MRReply_ArrayElement(names, i), NULL);
+    RLookupKey *k = RLookup_GetKey(nc->lookup, name, RLOOKUP_F_NAMEALLOC | RLOOKUP_F_NOINCREF);
+    if (!k) {
+      k = RLookup_GetKey(nc->lookup, name,
+                         RLOOKUP_F_NAMEALLOC | RLOOKUP_F_NOINCREF | RLOOKUP_F_OCREAT);
+    }
+    nc->columns[nc->numColumns++] = k;
+  }
+}
+
+/* Write the values of a packed row. Fails the query if the row is malformed */
+static int writePackedRow(RPNet *nc, MRReply *rep, SearchResult *r) {
+  size_t len;
+  const char *p = MRReply_String(rep, &len);
+  const char *end = p + len;
+  for (size_t i = 0; i < nc->numColumns; i++) {
+    RSValue *v;
+    if (!(p = decodePackedValue(p, end, &v, 0))) {
+      RedisModule_Log(NULL, "warning", "A malformed packed row was received from a shard");
+      QueryError_SetError(nc->base.parent->err, QUERY_EGENERIC,
+                          "Malformed packed row received from a shard");
+      return RS_RESULT_ERROR;
+    }
+    RLookup_WriteOwnKey(nc->columns[i], &r->rowdata, v);
+  }
+  return RS_RESULT_OK;
+}
+
 static const RLookupKey *keyForField(RPNet *nc, const char *s) {
   for (const RLookupKey *kk = nc->lookup->head; kk; kk = kk->next) {
     if (!strcmp(kk->name, s)) {
@@ -187,9 +295,20 @@ static int rpnetNext(ResultProcessor *self, SearchResult *r) {
     // Get the index from the first
     nc->base.parent->totalResults += MRReply_Integer(MRReply_ArrayElement(nc->current.rows, 0));
     nc->curIdx = 1;
+    if (nc->packedRows && MRReply_Length(nc->current.rows) >= PACKED_ROWS_FIRST) {
+      resolvePackedColumns(nc);
+      nc->curIdx = PACKED_ROWS_FIRST;
+      if (nc->curIdx == MRReply_Length(nc->current.rows)) {
+        // only the column names, move on to the next chunk
+        return rpnetNext(self, r);
+      }
+    }
   }
 
   MRReply *rep = MRReply_ArrayElement(nc->current.rows, nc->curIdx++);
+  if (nc->packedRows && MRReply_Type(rep) == MR_REPLY_STRING) {
+    return writePackedRow(nc, rep, r);
+  }
   for (size_t i = 0; i < MRReply_Length(rep); i += 2) {
     const char *c = MRReply_String(MRReply_ArrayElement(rep, i), NULL);
     RSValue *v = RS_NullVal();
@@ -238,6 +357,7 @@ static void rpnetFree(ResultProcessor *rp) {
   }
 
   if (nc->it) MRIterator_Free(nc->it);
+  rm_free(nc->columns);
   free(rp);
 }
 
@@ -254,7 +374,7 @@ static RPNet *RPNet_New(const MRCommand *cmd, SearchCluster *sc) {
   return nc;
 }
 
-static void buildMRCommand(RedisModuleString **argv, int argc, int profileArgs,
+static void buildMRCommand(RedisModuleString **argv, int argc, int profileArgs, int packedRows,
                            AREQDIST_UpstreamInfo *us, MRCommand *xcmd) {
   // We need to prepend the array with the command, index, and query that
   // we want to use.
@@ -277,6 +397,9 @@ static void buildMRCommand(RedisModuleString **argv, int argc, int profileArgs,
   tmparr = array_append(tmparr, "WITHCURSOR");
   // Numeric responses are encoded as simple strings.
   tmparr = array_append(tmparr, "_NUM_SSTRING");
+  if (packedRows) {
+    tmparr = array_append(tmparr, "_PACKED_ROWS");
+  }
 
   for (size_t ii = 0; ii < us->nserialized; ++ii) {
     tmparr = array_append(tmparr, us->serialized[ii]);
@@ -289,10 +412,11 @@ static void buildMRCommand(RedisModuleString **argv, int argc, int profileArgs,
 }
 
 static void buildDistRPChain(AREQ *r, MRCommand *xcmd, SearchCluster *sc,
-                             AREQDIST_UpstreamInfo *us) {
+                             AREQDIST_UpstreamInfo *us, int packedRows) {
   // Establish our root processor, which is the distributed processor
   RPNet *rpRoot = RPNet_New(xcmd, sc);
   rpRoot->lookup = us->lookup;
+  rpRoot->packedRows = packedRows;
 
   assert(!r->qiter.rootProc);
   // Get the deepest-most root:
@@ -399,10 +523,11 @@ void RSExecDistAggregate(RedisModuleCtx *ctx, RedisModuleString **argv, int argc
 
   // Construct the command string
   MRCommand xcmd;
-  buildMRCommand(argv , argc, profileArgs, &us, &xcmd);
+  int packedRows = clusterConfig.packedRows;
+  buildMRCommand(argv , argc, profileArgs, packedRows, &us, &xcmd);
 
   // Build the result processor chain
-  buildDistRPChain(r, &xcmd, sc, &us);
+  buildDistRPChain(r, &xcmd, sc, &us, packedRows);
 
   if (IsProfile(r)) r->parseTime = clock() - r->initClock;
 
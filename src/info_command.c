@@ -150,7 +150,7 @@ static void handleSpecialField(InfoFields *fields, const char *name, MRReply *va
 
 static void processKvArray(InfoFields *ctx, MRReply *array, InfoValue *dsts, InfoFieldSpec *specs,
                            size_t numFields, int onlyScalarValues) {
-  if (MRReply_Type(array) != MR_REPLY_ARRAY) {
+  if (MRReply_Type(array) != MR_REPLY_ARRAY && MRReply_Type(array) != MR_REPLY_MAP) {
     return;
   }
   size_t numElems = MRReply_Length(array);
@@ -279,7 +279,7 @@ int InfoReplyReducer(struct MRCtx *mc, int count, MRReply **replies) {
       }
       continue;
     }
-    if (MRReply_Type(replies[ii]) != MR_REPLY_ARRAY) {
+    if (MRReply_Type(replies[ii]) != MR_REPLY_ARRAY && MRReply_Type(replies[ii]) != MR_REPLY_MAP) {
       continue;  // Ooops!
     }
 
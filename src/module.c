@@ -5,6 +5,7 @@
 #include "dep/rmr/hiredis/alloc.h"
 #include "dep/rmr/hiredis/async.h"
 #include "dep/rmr/reply.h"
+#include "dep/rmr/fast_float.h"
 #include "dep/rmutil/util.h"
 #include "dep/rmutil/strings.h"
 #include "crc16_tags.h"
@@ -24,6 +25,8 @@
 #include "value.h"
 #include "cluster_spell_check.h"
 #include "profile.h"
+#include "search_cursor.h"
+#include "search_result.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -31,8 +34,13 @@
 #include <sys/param.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define CLUSTERDOWN_ERR "ERRCLUSTER Uninitialized cluster state, could not perform command"
+#define SEARCHAFTER_DISABLED_ERR \
+  "SEARCHAFTER needs SEARCHAFTER_FORWARDING, which all the shards must support"
 
 int redisMajorVesion = 0;
 int redisMinorVesion = 0;
@@ -110,54 +118,53 @@ cleanup:
 
   return REDISMODULE_OK;
 }
-/* A reducer that just merges N arrays of the same length, selecting the first non NULL reply from
- * each */
-int mergeArraysReducer(struct MRCtx *mc, int count, MRReply **replies) {
+/* Gather the replies of an MGET that was split by the shards owning its keys, back into the order
+ * of the keys. Keys whose shard could not be reached are nil, as if they didn't exist */
+int mgetReducer(struct MRCtx *mc, int count, MRReply **replies) {
 
   RedisModuleCtx *ctx = MRCtx_GetRedisCtx(mc);
 
   for (size_t i = 0; i < count; ++i) {
-    if (MRReply_Type(replies[i]) == MR_REPLY_ERROR) {
+    if (replies[i] && MRReply_Type(replies[i]) == MR_REPLY_ERROR) {
       // we got an error reply, something goes wrong so we return the error to the user.
       return MR_ReplyWithMRReply(ctx, replies[i]);
     }
   }
+  if (count == 0) {
+    return RedisModule_ReplyWithError(ctx, "Could not process replies");
+  }
 
-  int j = 0;
-  int stillValid;
-  do {
-    // the number of still valid arrays in the response
-    stillValid = 0;
-
-    for (int i = 0; i < count; i++) {
-      // if this is not an array - ignore it
-      if (MRReply_Type(replies[i]) != MR_REPLY_ARRAY) continue;
-      // if we've overshot the array length - ignore this one
-      if (MRReply_Length(replies[i]) <= j) continue;
-      // increase the number of valid replies
-      stillValid++;
-
-      // get the j element of array i
-      MRReply *ele = MRReply_ArrayElement(replies[i], j);
-      // if it's a valid response OR this is the last array we are scanning -
-      // add this element to the merged array
-      if (MRReply_Type(ele) != MR_REPLY_NIL || i + 1 == count) {
-        // if this is the first reply - we need to crack open a new array reply
-        if (j == 0) RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-
-        MR_ReplyWithMRReply(ctx, ele);
-        j++;
-        break;
-      }
+  int numKeys;
+  const int *keyCmds = MRCtx_GetKeyCommands(mc, &numKeys);
+  // the position of the next key in the reply of each command
+  size_t *next = calloc(count, sizeof(*next));
+  RedisModule_ReplyWithArray(ctx, numKeys);
+  for (int k = 0; k < numKeys; k++) {
+    int c = keyCmds[k];
+    MRReply *rep = c >= 0 ? replies[c] : NULL;
+    size_t pos = c >= 0 ? next[c]++ : 0;
+    if (rep && MRReply_Type(rep) == MR_REPLY_ARRAY && pos < MRReply_Length(rep)) {
+      MR_ReplyWithMRReply(ctx, MRReply_ArrayElement(rep, pos));
+    } else {
+      RedisModule_ReplyWithNull(ctx);
     }
-  } while (stillValid > 0);
-
-  // j 0 means we could not process a single reply element from any reply
-  if (j == 0) {
-    return RedisModule_ReplyWithError(ctx, "Could not process replies");
   }
-  RedisModule_ReplySetArrayLength(ctx, j);
+  free(next);
+  return REDISMODULE_OK;
+}
 
+/* Reply with the status of every document of FT.MADD in input order, replies are ordered so there
+ * is one per document */
+int maddReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  RedisModuleCtx *ctx = MRCtx_GetRedisCtx(mc);
+  RedisModule_ReplyWithArray(ctx, count);
+  for (int i = 0; i < count; i++) {
+    if (replies[i]) {
+      MR_ReplyWithMRReply(ctx, replies[i]);
+    } else {
+      RedisModule_ReplyWithError(ctx, "Could not send document to its shard");
+    }
+  }
   return REDISMODULE_OK;
 }
 
@@ -297,18 +304,6 @@ int allOKReducer(struct MRCtx *mc, int count, MRReply **replies) {
   return REDISMODULE_OK;
 }
 
-typedef struct {
-  char *id;
-  size_t idLen;
-  double score;
-  MRReply *explainScores;
-  MRReply *fields;
-  MRReply *payload;
-  const char *sortKey;
-  size_t sortKeyLen;
-  double sortKeyNum;
-} searchResult;
-
 typedef struct {
   char *queryString;
   long long offset;
@@ -325,10 +320,62 @@ typedef struct {
   int profileArgs;
   int profileLimited;
   clock_t profileClock;
+  // the reducer context replies are folded into as they arrive, if any
   void *reducer;
+
+  // shards are searched without content, and contentCmd fetches it for the returned page
+  int twoPhase;
+  MRCommand contentCmd;
+
+  // SEARCHAFTER {score|sortkey} {docid}: only results ordered after this one are returned
+  int withSearchAfter;
+  int searchAfterIndex;
+  searchResult searchAfter;
+  // the shards support SEARCHAFTER, and are sent the boundary, see SEARCHAFTER_FORWARDING
+  int forwardSearchAfter;
+
+  // WITHCURSOR [COUNT {count}] [MAXIDLE {ms}]: results are read in pages with FT.CURSOR, and
+  // cursorCmd is the shard query that pages are refilled by
+  int withCursor;
+  long long cursorCount;
+  long long cursorMaxIdle;
+  MRCommand cursorCmd;
+  // the positions of WITHCURSOR, COUNT, MAXIDLE and LIMIT in the arguments, 0 if not given
+  int cursorIndex;
+  int cursorCountIndex;
+  int cursorMaxIdleIndex;
+  int limitIndex;
+
+  // with top-K pruning the shards first send their top pruneLimit results, and pruneCmd searches
+  // the shards that may hold more of the top K again, see searchPruneReducer
+  int topkPruning;
+  long long pruneLimit;
+  MRCommand pruneCmd;
+  // the SORTBY field, to bound the second round of a numeric sort by
+  char *sortField;
+
+  // APPROXCOUNT {cap}: shards may estimate their totals once they count cap matches, 0 if unset.
+  // Unless the shards support it, it isn't forwarded and the totals are exact
+  long long approxCount;
+  int approxCountIndex;
+  int forwardApproxCount;
 } searchRequestCtx;
 
 void searchRequestCtx_Free(searchRequestCtx *r) {
+  if (r->twoPhase) {
+    MRCommand_Free(&r->contentCmd);
+  }
+  if (r->cursorCmd.strs) {
+    MRCommand_Free(&r->cursorCmd);
+  }
+  if (r->pruneCmd.strs) {
+    MRCommand_Free(&r->pruneCmd);
+  }
+  free(r->sortField);
+  if (r->withSearchAfter) {
+    free(r->searchAfter.id);
+    free((char *)r->searchAfter.sortKey);
+  }
   free(r->queryString);
   free(r);
 }
@@ -336,6 +383,65 @@ void searchRequestCtx_Free(searchRequestCtx *r) {
 static int searchResultReducer(struct MRCtx *mc, int count, MRReply **replies);
 static int profileSearchResultReducer(struct MRCtx *mc, int count, MRReply **replies);
 
+/* Parse the SEARCHAFTER boundary into a result that the results of the next page are compared
+ * against. The value is a sorting key as returned by WITHSORTKEYS under SORTBY, or a score */
+static int rscParseSearchAfter(searchRequestCtx *req, RedisModuleString **argv, int argc,
+                               int argvOffset) {
+  searchResult *after = &req->searchAfter;
+  memset(after, 0, sizeof(*after));
+  req->withSearchAfter = 0;
+  int idx = RMUtil_ArgIndex("SEARCHAFTER", argv + argvOffset, argc - argvOffset);
+  if (idx < 0) {
+    return REDISMODULE_OK;
+  }
+  idx += argvOffset;
+  if (idx + 2 >= argc) {
+    return REDISMODULE_ERR;
+  }
+
+  size_t len;
+  const char *value = RedisModule_StringPtrLen(argv[idx + 1], &len);
+  if (req->withSortby) {
+    searchResult_SetSortKey(after, strndup(value, len), len);
+  } else if (RedisModule_StringToDouble(argv[idx + 1], &after->score) != REDISMODULE_OK) {
+    return REDISMODULE_ERR;
+  }
+  const char *id = RedisModule_StringPtrLen(argv[idx + 2], &len);
+  after->id = strndup(id, len);
+  after->idLen = after->keyLen = len;
+  req->withSearchAfter = 1;
+  req->searchAfterIndex = idx;
+  return REDISMODULE_OK;
+}
+
+/* The maximal number of results a search cursor asks a shard for at once, and so buffers of it.
+ * Bounds OFFSET + COUNT of its first page and COUNT of its reads */
+#define SEARCH_CURSOR_MAX_ROWS 10000
+
+/* Parse WITHCURSOR and its options. A page is as long as the LIMIT by default, and the max idle
+ * time is capped by the one of aggregate cursors */
+static int rscParseCursor(searchRequestCtx *req, RedisModuleString **argv, int argc,
+                          int argvOffset) {
+  req->cursorCount = req->limit;
+  req->cursorMaxIdle = RSGlobalConfig.cursorMaxIdle;
+  req->cursorIndex = RMUtil_ArgExists("WITHCURSOR", argv, argc, argvOffset);
+  req->withCursor = req->cursorIndex != 0;
+  if (!req->withCursor) {
+    return REDISMODULE_OK;
+  }
+  long long maxIdle = -1;
+  req->cursorCountIndex = RMUtil_ArgExists("COUNT", argv, argc, argvOffset);
+  req->cursorMaxIdleIndex = RMUtil_ArgExists("MAXIDLE", argv, argc, argvOffset);
+  RMUtil_ParseArgsAfter("COUNT", argv + argvOffset, argc - argvOffset, "l", &req->cursorCount);
+  RMUtil_ParseArgsAfter("MAXIDLE", argv + argvOffset, argc - argvOffset, "l", &maxIdle);
+  if (maxIdle > 0) {
+    req->cursorMaxIdle = MIN(maxIdle, req->cursorMaxIdle);
+  }
+  return req->cursorCount > 0 && req->offset + req->cursorCount <= SEARCH_CURSOR_MAX_ROWS
+             ? REDISMODULE_OK
+             : REDISMODULE_ERR;
+}
+
 static int rscParseProfile(searchRequestCtx *req, RedisModuleString **argv) {
   req->profileArgs = 0;
   if (RMUtil_ArgIndex("FT.PROFILE", argv, 1) != -1) {
@@ -369,6 +475,13 @@ searchRequestCtx *rscParseRequest(RedisModuleString **argv, int argc) {
   req->queryString = strdup(RedisModule_StringPtrLen(argv[argvOffset++], NULL));
   req->limit = 10;
   req->offset = 0;
+  req->reducer = NULL;
+  req->twoPhase = 0;
+  memset(&req->cursorCmd, 0, sizeof(req->cursorCmd));
+  req->topkPruning = 0;
+  memset(&req->pruneCmd, 0, sizeof(req->pruneCmd));
+  req->sortField = NULL;
+  req->forwardSearchAfter = clusterConfig.searchAfterForwarding;
   // marks the user set WITHSCORES. internally it's always set
   req->withScores = RMUtil_ArgExists("WITHSCORES", argv, argc, argvOffset) != 0;
   req->withExplainScores = RMUtil_ArgExists("EXPLAINSCORE", argv, argc, argvOffset) != 0;
@@ -403,103 +516,63 @@ searchRequestCtx *rscParseRequest(RedisModuleString **argv, int argc) {
   req->withPayload = RMUtil_ArgExists("WITHPAYLOADS", argv, argc, argvOffset) != 0;
 
   // Parse LIMIT argument
+  req->limitIndex = RMUtil_ArgExists("LIMIT", argv, argc, argvOffset);
   RMUtil_ParseArgsAfter("LIMIT", argv + argvOffset, argc - argvOffset, "ll", &req->offset, &req->limit);
   if (req->limit < 0 || req->offset < 0) {
     free(req);
     return NULL;
   }
 
-  return req;
-}
-
-static int cmpStrings(const char *s1, size_t l1, const char *s2, size_t l2) {
-  int cmp = memcmp(s1, s2, MIN(l1, l2));
-  if (l1 == l2) {
-    // if the strings are the same length, just return the result of strcmp
-    return cmp;
+  // Parse APPROXCOUNT {cap}, the cap must be positive
+  req->approxCount = 0;
+  req->forwardApproxCount = clusterConfig.approxCountForwarding;
+  int approxCountIndex = RMUtil_ArgExists("APPROXCOUNT", argv, argc, argvOffset);
+  req->approxCountIndex = approxCountIndex;
+  if (approxCountIndex) {
+    RMUtil_ParseArgs(argv, argc, approxCountIndex + 1, "l", &req->approxCount);
   }
-
-  // if the strings are identical but the lengths aren't, return the longer string
-  if (cmp == 0) {
-    return l1 > l2 ? 1 : -1;
-  } else {  // the strings are lexically different, just return that
-    return cmp;
+  if (approxCountIndex && req->approxCount <= 0) {
+    free(req->queryString);
+    free(req);
+    return NULL;
   }
-}
 
-static int cmp_results(const void *p1, const void *p2, const void *udata) {
+  if (rscParseSearchAfter(req, argv, argc, argvOffset) != REDISMODULE_OK ||
+      rscParseCursor(req, argv, argc, argvOffset) != REDISMODULE_OK) {
+    free(req->searchAfter.id);
+    free((char *)req->searchAfter.sortKey);
+    free(req->queryString);
+    free(req);
+    return NULL;
+  }
 
-  const searchResult *r1 = p1, *r2 = p2;
-  const searchRequestCtx *req = udata;
-  // Compary by sorting keys
-  if ((r1->sortKey || r2->sortKey) && req->withSortby) {
-    int cmp = 0;
-    // Sort by numeric sorting keys
-    if (r1->sortKeyNum != HUGE_VAL && r2->sortKeyNum != HUGE_VAL) {
-      double diff = r2->sortKeyNum - r1->sortKeyNum;
-      cmp = diff < 0 ? -1 : (diff > 0 ? 1 : 0);
-    } else if (r1->sortKey && r2->sortKey) {
+  return req;
+}
 
-      // Sort by string sort keys
-      cmp = cmpStrings(r2->sortKey, r2->sortKeyLen, r1->sortKey, r1->sortKeyLen);
-      // printf("Using sortKey!! <N=%lu> %.*s vs <N=%lu> %.*s. Result=%d\n", r2->sortKeyLen,
-      //        (int)r2->sortKeyLen, r2->sortKey, r1->sortKeyLen, (int)r1->sortKeyLen, r1->sortKey,
-      //        cmp);
-    } else {
-      // If at least one of these has a sort key
-      cmp = r2->sortKey ? 1 : -1;
-    }
-    // in case of a tie - compare ids
-    if (!cmp) {
-      // printf("It's a tie! Comparing <N=%lu> %.*s vs <N=%lu> %.*s\n", r2->idLen, (int)r2->idLen,
-      //        r2->id, r1->idLen, (int)r1->idLen, r1->id);
-      cmp = cmpStrings(r2->id, r2->idLen, r1->id, r1->idLen);
-    }
-    return (req->sortAscending ? -cmp : cmp);
+static searchResultCmp searchResultCmpFor(const searchRequestCtx *req) {
+  if (!req->withSortby) {
+    return cmpResultsByScore;
   }
+  return req->sortAscending ? cmpResultsBySortKeyAsc : cmpResultsBySortKeyDesc;
+}
 
-  double s1 = r1->score, s2 = r2->score;
-  // printf("Scores: %lf vs %lf. WithSortBy: %d. SK1=%p. SK2=%p\n", s1, s2, req->withSortby,
-  //        r1->sortKey, r2->sortKey);
-  if (s1 < s2) {
-    return 1;
-  } else if (s1 > s2) {
-    return -1;
-  } else {
-    // printf("Scores are tied. Will compare ID Strings instead\n");
-    
-    // This was reversed to be more compatible with OSS version where tie breaker was changed 
-    // to return the lower doc ID to reduce sorting heap work. Doc name might not be ascending 
-    // or decending but this still may reduce heap work.
-    // Our tests are usually ascending so this will create similarity between RS and RSC.
-    int rv = -cmpStrings(r2->id, r2->idLen, r1->id, r1->idLen);
-    
-    // printf("ID Strings: Comparing <N=%lu> %.*s vs <N=%lu> %.*s => %d\n", r2->idLen,
-    // (int)r2->idLen,
-    //        r2->id, r1->idLen, (int)r1->idLen, r1->id, rv);
-    return rv;
-  }
-}
-
-searchResult *newResult(searchResult *cached, MRReply *arr, int j, int scoreOffset,
+searchResult *newResult(searchResult *res, MRReply *arr, int j, int scoreOffset,
                         int payloadOffset, int fieldsOffset, int sortKeyOffset, int explainScores) {
-  searchResult *res = cached ? cached : malloc(sizeof(searchResult));
   res->sortKey = NULL;
-  res->sortKeyNum = HUGE_VAL;
+  res->sortKeyIsNum = false;
   if (MRReply_Type(MRReply_ArrayElement(arr, j)) != MR_REPLY_STRING) {
     res->id = NULL;
     return res;
   }
   res->id = MRReply_String(MRReply_ArrayElement(arr, j), &res->idLen);
-  // if the id contains curly braces, get rid of them now
+  // if the id contains curly braces, get rid of them now. The full key is kept to fetch the
+  // result's content by
   if (res->id) {
     MRKey mk;
     MRKey_Parse(&mk, res->id, res->idLen);
+    res->keyLen = res->idLen;
     res->idLen = mk.baseLen;
     res->id = (char *)mk.base;
-    if (mk.shardLen) {
-      res->id[res->idLen] = '\0';
-    }
   } else {  // this usually means an invalid result
     return res;
   }
@@ -529,33 +602,108 @@ searchResult *newResult(searchResult *cached, MRReply *arr, int j, int scoreOffs
   res->fields = fieldsOffset > 0 ? MRReply_ArrayElement(arr, j + fieldsOffset) : NULL;
   // get payloads
   res->payload = payloadOffset > 0 ? MRReply_ArrayElement(arr, j + payloadOffset) : NULL;
-  if (sortKeyOffset > 0) {
-    res->sortKey = MRReply_String(MRReply_ArrayElement(arr, j + sortKeyOffset), &res->sortKeyLen);
-  } else {
-    res->sortKey = NULL;
-  }
-  if (res->sortKey) {
-    if (res->sortKey[0] == '#') {
-      char *eptr;
-      double d = strtod(res->sortKey + 1, &eptr);
-      if (eptr != res->sortKey + 1 && *eptr == 0) {
-        res->sortKeyNum = d;
-      }
-    }
-    // fprintf(stderr, "Sort key string '%s', num '%f\n", res->sortKey, res->sortKeyNum);
+  MRReply *sortKey = sortKeyOffset > 0 ? MRReply_ArrayElement(arr, j + sortKeyOffset) : NULL;
+  const char *sortKeyStr = sortKey ? MRReply_String(sortKey, &res->sortKeyLen) : NULL;
+  if (sortKey && MRReply_Type(sortKey) == MR_REPLY_DOUBLE) {
+    // a native RESP3 double needs no parsing
+    res->sortKey = sortKeyStr;
+    res->sortKeyIsNum = true;
+    res->sortKeyBits = encodeSortKeyNum(MRReply_Double(sortKey));
+  } else if (sortKeyStr) {
+    searchResult_SetSortKey(res, sortKeyStr, res->sortKeyLen);
   }
   return res;
 }
 
+/* Results are allocated from chunks owned by the reducer, and all freed with it. The heap never
+ * holds more than offset + limit results, and at most one more is being parsed, so that bounds the
+ * chunks' total size */
+#define SEARCH_RESULT_CHUNK_MIN 16
+#define SEARCH_RESULT_CHUNK_MAX 1024
+
+typedef struct searchResultChunk {
+  struct searchResultChunk *next;
+  size_t used;
+  size_t cap;
+  searchResult results[];
+} searchResultChunk;
+
 typedef struct {
   MRReply *lastError;
   searchResult *cachedResult;
   searchRequestCtx *searchCtx;
   heap_t *pq;
   size_t totalReplies;
+  // the variance of the estimated part of the total, see searchTotalVariance
+  double totalVariance;
   bool errorOccured;
+  // replies are owned by the reducer, and freed as soon as none of their results are in the heap
+  bool incremental;
+  searchResultChunk *resultChunks;
+  size_t numResults;
+  searchResultCmp cmp;
 } searchReducerCtx;
 
+static searchResult *searchReducerCtx_NewResult(searchReducerCtx *rCtx) {
+  searchResultChunk *c = rCtx->resultChunks;
+  if (!c || c->used == c->cap) {
+    size_t cap = c ? MIN(c->cap * 2, SEARCH_RESULT_CHUNK_MAX) : SEARCH_RESULT_CHUNK_MIN;
+    size_t left = heap_size(rCtx->pq) + 1 - rCtx->numResults;
+    cap = MAX(MIN(cap, left), 1);
+    c = rm_malloc(sizeof(*c) + cap * sizeof(*c->results));
+    c->next = rCtx->resultChunks;
+    c->used = 0;
+    c->cap = cap;
+    rCtx->resultChunks = c;
+  }
+  rCtx->numResults++;
+  return &c->results[c->used++];
+}
+
+/* A folded reply, alive while the heap holds some of its results or it is being processed */
+typedef struct searchReplyHolder {
+  MRReply *reply;
+  size_t refcount;
+} searchReplyHolder;
+
+static void searchReplyHolder_Release(searchReplyHolder *h) {
+  if (h && !--h->refcount) {
+    MRReply_Free(h->reply);
+    free(h);
+  }
+}
+
+/* Release the reply of a result that is no longer in the heap, if it was the last one in it */
+static void searchResult_ReleaseReply(searchResult *res) {
+  searchReplyHolder_Release(res->holder);
+  res->holder = NULL;
+}
+
+static void searchReducerCtx_Init(searchReducerCtx *rCtx, searchRequestCtx *req) {
+  size_t num = req->offset + req->limit;
+  rCtx->pq = rm_malloc(heap_sizeof(num));
+  rCtx->cmp = searchResultCmpFor(req);
+  heap_init(rCtx->pq, rCtx->cmp, req, num);
+  rCtx->searchCtx = req;
+}
+
+static void searchReducerCtx_Clear(searchReducerCtx *rCtx) {
+  if (rCtx->pq) {
+    searchResult *res;
+    while ((res = heap_poll(rCtx->pq))) {
+      searchResult_ReleaseReply(res);
+    }
+    heap_free(rCtx->pq);
+    rCtx->pq = NULL;
+  }
+  rCtx->cachedResult = NULL;
+  while (rCtx->resultChunks) {
+    searchResultChunk *next = rCtx->resultChunks->next;
+    rm_free(rCtx->resultChunks);
+    rCtx->resultChunks = next;
+  }
+}
+
 typedef struct {
   int step;  // offset for next reply
   int score;
@@ -564,7 +712,8 @@ typedef struct {
   int sortKey;
 } searchReplyOffsets;
 
-static void getReplyOffsets(const searchRequestCtx *ctx, searchReplyOffsets *offsets) {
+static void getReplyOffsets(const searchRequestCtx *ctx, int noContent,
+                            searchReplyOffsets *offsets) {
   offsets->step = 3;  // 1 for key, 1 for score, 1 for fields
   offsets->score = 1;
 
@@ -582,12 +731,36 @@ static void getReplyOffsets(const searchRequestCtx *ctx, searchReplyOffsets *off
     offsets->sortKey = offsets->firstField++;
   }
   // nocontent - one less field, and the offset is -1 to avoid parsing it
-  if (ctx->noContent) {
+  if (noContent) {
     offsets->step--;
     offsets->firstField = -1;
   }
 }
 
+/* The variance a shard's total adds to the total of the reply. Under APPROXCOUNT a shard that
+ * reached the cap estimates its total from the first cap matches it counted, with a relative
+ * standard error of 1/sqrt(cap). The totals of the other shards, and all of them when APPROXCOUNT
+ * isn't forwarded, are exact */
+static double searchTotalVariance(const searchRequestCtx *req, long long total) {
+  if (!req->approxCount || !req->forwardApproxCount || total < req->approxCount) {
+    return 0;
+  }
+  return (double)total * total / req->approxCount;
+}
+
+/* Reply with the total of a search. Under APPROXCOUNT it is the estimate and its error bound, the
+ * standard error of the shards' estimates combined */
+static void replyWithSearchTotal(RedisModuleCtx *ctx, const searchRequestCtx *req, long long total,
+                                 double variance) {
+  if (!req->approxCount) {
+    RedisModule_ReplyWithLongLong(ctx, total);
+    return;
+  }
+  RedisModule_ReplyWithArray(ctx, 2);
+  RedisModule_ReplyWithLongLong(ctx, total);
+  RedisModule_ReplyWithLongLong(ctx, llround(sqrt(variance)));
+}
+
 static void processSearchReply(MRReply *arr, searchReducerCtx *rCtx, RedisModuleCtx *ctx) {
   if (arr == NULL) {
     return;
@@ -602,10 +775,20 @@ static void processSearchReply(MRReply *arr, searchReducerCtx *rCtx, RedisModule
   }
 
   // first element is always the total count
-  rCtx->totalReplies += MRReply_Integer(MRReply_ArrayElement(arr, 0));
+  long long total = MRReply_Integer(MRReply_ArrayElement(arr, 0));
+  rCtx->totalReplies += total;
+  rCtx->totalVariance += searchTotalVariance(rCtx->searchCtx, total);
+  // hold the reply while it is being processed, its results in the heap keep holding it after that
+  searchReplyHolder *holder = NULL;
+  if (rCtx->incremental) {
+    holder = malloc(sizeof(*holder));
+    holder->reply = arr;
+    holder->refcount = 1;
+  }
   size_t len = MRReply_Length(arr);
   searchReplyOffsets offsets = {0};
-  getReplyOffsets(rCtx->searchCtx, &offsets);
+  getReplyOffsets(rCtx->searchCtx, rCtx->searchCtx->noContent || rCtx->searchCtx->twoPhase,
+                  &offsets);
 
   // fprintf(stderr, "Step %d, scoreOffset %d, fieldsOffset %d, sortKeyOffset %d\n", step,
   //         scoreOffset, fieldsOffset, sortKeyOffset);
@@ -617,8 +800,9 @@ static void processSearchReply(MRReply *arr, searchReducerCtx *rCtx, RedisModule
       rCtx->errorOccured = true;
       break;
     }
-    searchResult *res = newResult(rCtx->cachedResult, arr, j, offsets.score, offsets.payload,
-                                  offsets.firstField, offsets.sortKey, rCtx->searchCtx->withExplainScores);
+    searchResult *res = rCtx->cachedResult ? rCtx->cachedResult : searchReducerCtx_NewResult(rCtx);
+    res = newResult(res, arr, j, offsets.score, offsets.payload, offsets.firstField,
+                    offsets.sortKey, rCtx->searchCtx->withExplainScores);
     if (!res || !res->id) {
       RedisModule_Log(ctx, "warning", "got an unexpected argument when parsing redisearch results");
       rCtx->errorOccured = true;
@@ -628,96 +812,348 @@ static void processSearchReply(MRReply *arr, searchReducerCtx *rCtx, RedisModule
       break;
     } else {
       rCtx->cachedResult = NULL;
+      res->holder = NULL;
     }
 
-    // fprintf(stderr, "Response %d result %d Reply docId %s score: %f sortkey %f\n", i, j,
-    //         res->id, res->score, res->sortKeyNum);
+    // results up to the SEARCHAFTER boundary were returned with the previous pages, shards may
+    // send the ones tied with it again
+    if (rCtx->searchCtx->withSearchAfter &&
+        rCtx->cmp(res, &rCtx->searchCtx->searchAfter, rCtx->searchCtx) <= 0) {
+      rCtx->cachedResult = res;
+      continue;
+    }
 
     // TODO: minmax_heap?
     if (heap_count(rCtx->pq) < heap_size(rCtx->pq)) {
       // printf("Offering result score %f\n", res->score);
       heap_offerx(rCtx->pq, res);
+      if (holder) {
+        res->holder = holder;
+        holder->refcount++;
+      }
 
     } else {
       searchResult *smallest = heap_peek(rCtx->pq);
-      int c = cmp_results(res, smallest, rCtx->searchCtx);
+      int c = rCtx->cmp(res, smallest, rCtx->searchCtx);
       if (c < 0) {
         smallest = heap_poll(rCtx->pq);
         heap_offerx(rCtx->pq, res);
+        if (holder) {
+          res->holder = holder;
+          holder->refcount++;
+        }
+        searchReplyHolder_Release(smallest->holder);
         rCtx->cachedResult = smallest;
       } else {
         rCtx->cachedResult = res;
-        if (rCtx->searchCtx->withSortby) {
-          // If the result is lower than the last result in the heap,
-          // AND there is a user-defined sort order - we can stop now
+        // Shard replies are sorted, so once a result doesn't make it into the heap none of the
+        // results after it will. Under score ordering only a strictly lower score proves it, as
+        // shards break score ties by their internal ids rather than by the key
+        if (rCtx->searchCtx->withSortby || res->score < smallest->score) {
           break;
         }
       }
     }
   }
+  searchReplyHolder_Release(holder);
 }
 
-static void sendSearchResults(RedisModuleCtx *ctx, searchReducerCtx *rCtx) {
-  // Reverse the top N results
-  searchRequestCtx *req = rCtx->searchCtx;
-
-  // Number of results to actually return
-  size_t num = req->limit + req->offset;
+/* Fold a shard reply into the heap as soon as it arrives. Errors are left to the reducer */
+static MRReply *searchReplyFold(struct MRCtx *mc, MRReply *reply) {
+  searchRequestCtx *req = MRCtx_GetPrivdata(mc);
+  searchReducerCtx *rCtx = req->reducer;
+  if (!rCtx) {
+    rCtx = req->reducer = calloc(1, sizeof(*rCtx));
+    searchReducerCtx_Init(rCtx, req);
+    rCtx->incremental = true;
+  }
+  processSearchReply(reply, rCtx, NULL);
+  return MRReply_Type(reply) == MR_REPLY_ARRAY && MRReply_Length(reply) > 0 ? NULL : reply;
+}
 
+/* Load the results from the heap into a sorted array, and free the heap */
+static searchResult **searchReducerCtx_Drain(searchReducerCtx *rCtx, size_t *len) {
   size_t qlen = heap_count(rCtx->pq);
   size_t pos = qlen;
 
-  // Load the results from the heap into a sorted array. Free the items in
-  // the heap one-by-one so that we don't have to go through them again
-  searchResult *results[qlen];
+  // Free the items in the heap one-by-one so that we don't have to go through them again
+  searchResult **results = rm_malloc(MAX(qlen, 1) * sizeof(*results));
   while (pos) {
     results[--pos] = heap_poll(rCtx->pq);
   }
   heap_free(rCtx->pq);
   rCtx->pq = NULL;
+  *len = qlen;
+  return results;
+}
+
+/* Reply with a single result, returning the number of elements it took */
+static size_t replyWithSearchResult(RedisModuleCtx *ctx, const searchRequestCtx *req,
+                                    const searchResult *res) {
+  size_t len = 1;
+  RedisModule_ReplyWithStringBuffer(ctx, res->id, res->idLen);
+  if (req->withScores) {
+    if (req->withExplainScores) {
+      RedisModule_ReplyWithArray(ctx, 2);
+    }
+    RedisModule_ReplyWithDouble(ctx, res->score);
+    if (req->withExplainScores) {
+        MR_ReplyWithMRReply(ctx, res->explainScores);
+    }
+    len++;
+  }
+  if (req->withPayload) {
+
+    MR_ReplyWithMRReply(ctx, res->payload);
+    len++;
+  }
+  if (req->withSortingKeys && req->withSortby) {
+    len++;
+    if (res->sortKey) {
+      RedisModule_ReplyWithStringBuffer(ctx, res->sortKey, res->sortKeyLen);
+    } else {
+      RedisModule_ReplyWithNull(ctx);
+    }
+  }
+  if (!req->noContent) {
+    MR_ReplyWithMRReply(ctx, res->fields);
+    len++;
+  }
+  return len;
+}
+
+/* Release the replies of the sorted results, the results themselves are freed with the reducer */
+static void searchResults_Release(searchResult **results, size_t qlen) {
+  for (size_t pos = 0; pos < qlen; pos++) {
+    searchResult_ReleaseReply(results[pos]);
+  }
+  rm_free(results);
+}
+
+/* Reply with the requested page of the sorted results, and release them */
+static void replyWithSearchResults(RedisModuleCtx *ctx, searchReducerCtx *rCtx,
+                                   searchResult **results, size_t qlen) {
+  searchRequestCtx *req = rCtx->searchCtx;
+
+  // Number of results to actually return
+  size_t num = req->limit + req->offset;
+  size_t pos;
 
   RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-  RedisModule_ReplyWithLongLong(ctx, rCtx->totalReplies);
+  replyWithSearchTotal(ctx, req, rCtx->totalReplies, rCtx->totalVariance);
   size_t len = 1;
 
   for (pos = rCtx->searchCtx->offset; pos < qlen && pos < num; pos++) {
-    searchResult *res = results[pos];
-    RedisModule_ReplyWithStringBuffer(ctx, res->id, res->idLen);
-    len++;
-    if (req->withScores) {
-      if (req->withExplainScores) {
-        RedisModule_ReplyWithArray(ctx, 2);
-      }
-      RedisModule_ReplyWithDouble(ctx, res->score);
-      if (req->withExplainScores) {
-          MR_ReplyWithMRReply(ctx, res->explainScores);
-      }
-      len++;
+    len += replyWithSearchResult(ctx, req, results[pos]);
+  }
+  RedisModule_ReplySetArrayLength(ctx, len);
+  searchResults_Release(results, qlen);
+}
+
+static void sendSearchResults(RedisModuleCtx *ctx, searchReducerCtx *rCtx) {
+  size_t qlen;
+  searchResult **results = searchReducerCtx_Drain(rCtx, &qlen);
+  replyWithSearchResults(ctx, rCtx, results, qlen);
+}
+
+/* The sorted results of a two-phase search, waiting for the content of the returned page */
+typedef struct {
+  searchReducerCtx rCtx;
+  searchResult **results;
+  size_t numResults;
+  // the returned page, sorted by key to match the fetched content against
+  searchResult **byKey;
+  size_t pageLen;
+} searchContentCtx;
+
+static int cmpResultsByKey(const void *p1, const void *p2) {
+  const searchResult *r1 = *(const searchResult **)p1, *r2 = *(const searchResult **)p2;
+  return cmpStrings(r1->id, r1->keyLen, r2->id, r2->keyLen);
+}
+
+static searchResult *searchContentCtx_Find(searchContentCtx *cc, const char *key, size_t len) {
+  size_t lo = 0, hi = cc->pageLen;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    searchResult *res = cc->byKey[mid];
+    int cmp = cmpStrings(key, len, res->id, res->keyLen);
+    if (cmp == 0) {
+      return res;
+    } else if (cmp < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
     }
-    if (req->withPayload) {
+  }
+  return NULL;
+}
+
+/* Yields the commands of an array, handing them over to the map */
+typedef struct {
+  MRCommand *cmds;
+  size_t len;
+  size_t pos;
+} commandArrayIterator;
+
+static size_t commandArrayIterator_Len(void *ctx) {
+  return ((commandArrayIterator *)ctx)->len;
+}
+
+static int commandArrayIterator_Next(void *ctx, MRCommand *cmd) {
+  commandArrayIterator *it = ctx;
+  if (it->pos == it->len) {
+    return 0;
+  }
+  *cmd = it->cmds[it->pos++];
+  return 1;
+}
+
+static void commandArrayIterator_Free(void *ctx) {
+  commandArrayIterator *it = ctx;
+  while (it->pos < it->len) {
+    MRCommand_Free(&it->cmds[it->pos++]);
+  }
+  rm_free(it->cmds);
+  rm_free(it);
+}
+
+static int searchContentReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  searchContentCtx *cc = MRCtx_GetPrivdata(mc);
+  searchRequestCtx *req = cc->rCtx.searchCtx;
+  RedisModuleBlockedClient *bc = (RedisModuleBlockedClient *)MRCtx_GetRedisCtx(mc);
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(bc);
 
-      MR_ReplyWithMRReply(ctx, res->payload);
-      len++;
+  // replies are ordered, a shard that could not be sent to or did not reply leaves its slot NULL
+  MRReply *err = NULL;
+  int failed = 0;
+  for (int i = 0; i < count; i++) {
+    if (!replies[i]) {
+      failed = 1;
+    } else if (MRReply_Type(replies[i]) == MR_REPLY_ERROR) {
+      err = replies[i];
     }
-    if (req->withSortingKeys && req->withSortby) {
-      len++;
-      if (res->sortKey) {
-        RedisModule_ReplyWithStringBuffer(ctx, res->sortKey, res->sortKeyLen);
-      } else {
-        RedisModule_ReplyWithNull(ctx);
-      }
+  }
+  if (err || failed || count == 0) {
+    if (err) {
+      MR_ReplyWithMRReply(ctx, err);
+    } else {
+      RedisModule_ReplyWithError(ctx, "Could not fetch the content of the results from a shard");
+    }
+    searchResults_Release(cc->results, cc->numResults);
+    goto cleanup;
+  }
+
+  searchReplyOffsets offsets = {0};
+  getReplyOffsets(req, 0, &offsets);
+  for (int i = 0; i < count; i++) {
+    // documents deleted since the first phase are returned without content
+    if (MRReply_Type(replies[i]) != MR_REPLY_ARRAY) {
+      continue;
     }
-    if (!req->noContent) {
-      MR_ReplyWithMRReply(ctx, res->fields);
-      len++;
+    size_t len = MRReply_Length(replies[i]);
+    for (size_t j = 1; j + offsets.step <= len; j += offsets.step) {
+      size_t keyLen;
+      const char *key = MRReply_String(MRReply_ArrayElement(replies[i], j), &keyLen);
+      searchResult *res = key ? searchContentCtx_Find(cc, key, keyLen) : NULL;
+      if (res) {
+        res->fields = MRReply_ArrayElement(replies[i], j + offsets.firstField);
+      }
     }
   }
-  RedisModule_ReplySetArrayLength(ctx, len);
+  replyWithSearchResults(ctx, &cc->rCtx, cc->results, cc->numResults);
+
+cleanup:
+  searchReducerCtx_Clear(&cc->rCtx);
+  rm_free(cc->byKey);
+  rm_free(cc);
+  searchRequestCtx_Free(req);
+  RedisModule_UnblockClient(bc, mc);
+  RedisModule_FreeThreadSafeContext(ctx);
+  MR_requestCompleted();
+  MRCtx_Free(mc);
+  return REDISMODULE_OK;
+}
+
+/* Fetch the content of the returned page of a two-phase search from the shards that own its
+ * documents, by running the original query restricted to their keys. On success the sorted
+ * results, the reducer and the request are handed over to searchContentReducer, which replies and
+ * frees them, and replies with an error if a shard fails or none of the commands can be sent.
+ * Returns REDISMODULE_ERR if none of the page's keys can be routed */
+static int searchFetchContent(struct MRCtx *mc, searchReducerCtx *rCtx, searchResult **results,
+                              size_t qlen) {
+  searchRequestCtx *req = rCtx->searchCtx;
+  size_t first = MIN((size_t)req->offset, qlen);
+  size_t pageLen = MIN((size_t)(req->offset + req->limit), qlen) - first;
+  searchResult **page = results + first;
+  if (pageLen == 0) {
+    return REDISMODULE_ERR;
+  }
 
-  // Free the sorted results
-  for (pos = 0; pos < qlen; pos++) {
-    free(results[pos]);
+  int *shards = rm_malloc(pageLen * sizeof(*shards));
+  int *slots = rm_malloc(pageLen * sizeof(*slots));
+  size_t numRouted = 0;
+  for (size_t i = 0; i < pageLen; i++) {
+    shards[i] = MR_ShardForKey(page[i]->id, page[i]->keyLen, &slots[i]);
+    numRouted += shards[i] >= 0;
   }
+  if (numRouted == 0) {
+    rm_free(shards);
+    rm_free(slots);
+    return REDISMODULE_ERR;
+  }
+
+  // a command per shard with the keys it owns, keys are marked with -1 once added to one
+  MRCommand *cmds = rm_malloc(pageLen * sizeof(*cmds));
+  size_t numCmds = 0;
+  for (size_t i = 0; i < pageLen; i++) {
+    int shard = shards[i];
+    if (shard < 0) {
+      continue;
+    }
+    size_t n = 0;
+    for (size_t j = i; j < pageLen; j++) {
+      n += shards[j] == shard;
+    }
+    MRCommand *cmd = &cmds[numCmds++];
+    *cmd = MRCommand_Copy(&req->contentCmd);
+    cmd->targetSlot = slots[i];
+    char buf[32];
+    MRCommand_Append(cmd, "INKEYS", strlen("INKEYS"));
+    MRCommand_Append(cmd, buf, snprintf(buf, sizeof(buf), "%zu", n));
+    for (size_t j = i; j < pageLen; j++) {
+      if (shards[j] == shard) {
+        MRCommand_Append(cmd, page[j]->id, page[j]->keyLen);
+        shards[j] = -1;
+      }
+    }
+  }
+  rm_free(shards);
+  rm_free(slots);
+
+  searchContentCtx *cc = rm_malloc(sizeof(*cc));
+  cc->rCtx = *rCtx;
+  cc->results = results;
+  cc->numResults = qlen;
+  cc->pageLen = pageLen;
+  cc->byKey = rm_malloc(pageLen * sizeof(*cc->byKey));
+  memcpy(cc->byKey, page, pageLen * sizeof(*cc->byKey));
+  qsort(cc->byKey, pageLen, sizeof(*cc->byKey), cmpResultsByKey);
+
+  commandArrayIterator *it = rm_malloc(sizeof(*it));
+  *it = (commandArrayIterator){.cmds = cmds, .len = numCmds, .pos = 0};
+  MRCommandGenerator cg = {.ctx = it,
+                           .Len = commandArrayIterator_Len,
+                           .Next = commandArrayIterator_Next,
+                           .Free = commandArrayIterator_Free};
+
+  struct MRCtx *contentCtx = MR_CreateCtx(NULL, cc);
+  MRCtx_SetRedisCtx(contentCtx, MRCtx_GetRedisCtx(mc));
+  MRCtx_SetReduceFunction(contentCtx, searchContentReducer);
+  MRCtx_SetOrderedReplies(contentCtx);
+  MR_SetCoordinationStrategy(contentCtx, MRCluster_MastersOnly | MRCluster_FlatCoordination);
+  MR_Map(contentCtx, NULL, cg, false);
+  cg.Free(cg.ctx);
+  return REDISMODULE_OK;
 }
 
 /**
@@ -739,109 +1175,598 @@ size_t PrintShardProfile(RedisModuleCtx *ctx, int count, MRReply **replies, int
     for (int j = 0; j < len; ++j) {
       MR_ReplyWithMRReply(ctx, MRReply_ArrayElement(reply, j));
     }
-    retLen += len;
+    retLen += len;
+  }
+  return retLen;
+}
+
+static void profileSearchReply(RedisModuleCtx *ctx, searchReducerCtx *rCtx,
+                               int count, MRReply **replies,
+                               clock_t totalTime, clock_t postProccesTime) {
+  RedisModule_ReplyWithArray(ctx, 2);
+  // print results
+  sendSearchResults(ctx, rCtx);
+
+  // print profile of shards
+  int arrLen = 0;
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+
+  arrLen += PrintShardProfile(ctx, count, replies, 1);
+
+  // print coordinator stats
+  RedisModule_ReplyWithSimpleString(ctx, "Coordinator");
+  arrLen++;
+  // search cmd only do the heap so there is no parsing time
+  RedisModule_ReplyWithArray(ctx, 2);
+  RedisModule_ReplyWithSimpleString(ctx, "Total Coordinator time");
+  RedisModule_ReplyWithDouble(ctx, (double)(clock() - totalTime) / CLOCKS_PER_MILLISEC);
+  arrLen++;
+
+  RedisModule_ReplyWithArray(ctx, 2);
+  RedisModule_ReplyWithSimpleString(ctx, "Post Proccessing time");
+  RedisModule_ReplyWithDouble(ctx, (double)(clock() - postProccesTime) / CLOCKS_PER_MILLISEC); 
+  arrLen++;
+
+  RedisModule_ReplySetArrayLength(ctx, arrLen);
+}
+
+static int searchResultReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  clock_t postProccesTime;
+  RedisModuleBlockedClient *bc = (RedisModuleBlockedClient *)MRCtx_GetRedisCtx(mc);
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(bc);
+  searchRequestCtx *req = MRCtx_GetPrivdata(mc);
+  searchReducerCtx rCtx = {NULL};
+  int profile = (req->profileArgs > 0);
+
+  // replies that were folded as they arrived are already in the heap, and their slots are empty
+  searchReducerCtx *folded = req->reducer;
+  if (folded) {
+    rCtx = *folded;
+    free(folded);
+    req->reducer = NULL;
+  }
+
+  // got no replies - this means timeout
+  if (count == 0 || req->limit < 0) {
+    int res = RedisModule_ReplyWithError(ctx, "Could not send query to cluster");
+    searchReducerCtx_Clear(&rCtx);
+    RedisModule_UnblockClient(bc, mc);
+    RedisModule_FreeThreadSafeContext(ctx);
+    MR_requestCompleted();
+    MRCtx_Free(mc);
+    return res;
+  }
+
+  if (*replies && MRReply_Type(*replies) == MR_REPLY_ERROR) {
+    int res = MR_ReplyWithMRReply(ctx, *replies);
+    searchReducerCtx_Clear(&rCtx);
+    RedisModule_UnblockClient(bc, mc);
+    RedisModule_FreeThreadSafeContext(ctx);
+    MR_requestCompleted();
+    MRCtx_Free(mc);
+    return res;
+  }
+
+  if (!folded) {
+    searchReducerCtx_Init(&rCtx, req);
+    for (int i = 0; i < count; i++) {
+      MRReply *reply = (!profile) ? replies[i] : MRReply_ArrayElement(replies[i], 0);
+      processSearchReply(reply, &rCtx, ctx);
+    }
+  }
+  // If we didn't get any results and we got an error - return it.
+  // If some shards returned results and some errors - we prefer to show the results we got an not
+  // return an error. This might change in the future
+  if ((rCtx.totalReplies == 0 && rCtx.lastError != NULL) || rCtx.errorOccured) {
+    if (rCtx.lastError) {
+      MR_ReplyWithMRReply(ctx, rCtx.lastError);
+    } else {
+      RedisModule_ReplyWithError(ctx, "could not parse redisearch results");
+    }
+    goto cleanup;
+  }
+  
+  if (!profile) {
+    size_t qlen;
+    searchResult **results = searchReducerCtx_Drain(&rCtx, &qlen);
+    if (req->twoPhase && searchFetchContent(mc, &rCtx, results, qlen) == REDISMODULE_OK) {
+      // the content reducer replies to the client, and owns the results and the request now
+      RedisModule_FreeThreadSafeContext(ctx);
+      MR_requestCompleted();
+      MRCtx_Free(mc);
+      return REDISMODULE_OK;
+    }
+    replyWithSearchResults(ctx, &rCtx, results, qlen);
+  } else {
+    postProccesTime = clock();
+    profileSearchReply(ctx, &rCtx, count, replies, req->profileClock, postProccesTime);
+  }
+cleanup:
+  searchReducerCtx_Clear(&rCtx);
+
+  searchRequestCtx_Free(req);
+  RedisModule_UnblockClient(bc, mc);
+  RedisModule_FreeThreadSafeContext(ctx);
+  MR_requestCompleted();
+  MRCtx_Free(mc);
+  return REDISMODULE_OK;
+}
+
+/* The first round of top-K pruning asks every shard for this many times its even share of the top
+ * K, so that most shards complete in it */
+#define SEARCH_PRUNE_OVERSAMPLE 2
+
+/* Set the LIMIT a search command asks the shards for, adding one if it has none */
+static void searchSetShardLimit(MRCommand *cmd, long long limit) {
+  char buf[32];
+  size_t len = snprintf(buf, sizeof(buf), "%lld", limit);
+  for (int i = 3; i + 2 < cmd->num; i++) {
+    if (cmd->lens[i] == strlen("LIMIT") && !strncasecmp(cmd->strs[i], "LIMIT", cmd->lens[i])) {
+      MRCommand_ReplaceArg(cmd, i + 1, "0", 1);
+      MRCommand_ReplaceArg(cmd, i + 2, buf, len);
+      return;
+    }
+  }
+  MRCommand_AppendArgs(cmd, 2, "LIMIT", "0");
+  MRCommand_Append(cmd, buf, len);
+}
+
+/* The second round of a search with top-K pruning, see searchPruneReducer */
+typedef struct {
+  // holds the results of the shards the first round completed
+  searchReducerCtx rCtx;
+  MRReply **kept;
+  size_t numKept;
+  // the shards' totals, as the second round only counts the results within the threshold
+  size_t totalReplies;
+  double totalVariance;
+} searchPruneCtx;
+
+static int searchPruneRoundReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  searchPruneCtx *pc = MRCtx_GetPrivdata(mc);
+  searchRequestCtx *req = pc->rCtx.searchCtx;
+  RedisModuleBlockedClient *bc = (RedisModuleBlockedClient *)MRCtx_GetRedisCtx(mc);
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(bc);
+
+  for (int i = 0; i < count; i++) {
+    processSearchReply(replies[i], &pc->rCtx, ctx);
+  }
+  pc->rCtx.totalReplies = pc->totalReplies;
+  pc->rCtx.totalVariance = pc->totalVariance;
+  if ((pc->rCtx.totalReplies == 0 && pc->rCtx.lastError != NULL) || pc->rCtx.errorOccured) {
+    if (pc->rCtx.lastError) {
+      MR_ReplyWithMRReply(ctx, pc->rCtx.lastError);
+    } else {
+      RedisModule_ReplyWithError(ctx, "could not parse redisearch results");
+    }
+  } else {
+    sendSearchResults(ctx, &pc->rCtx);
+  }
+
+  searchReducerCtx_Clear(&pc->rCtx);
+  for (size_t i = 0; i < pc->numKept; i++) {
+    MRReply_Free(pc->kept[i]);
+  }
+  rm_free(pc->kept);
+  rm_free(pc);
+  searchRequestCtx_Free(req);
+  RedisModule_UnblockClient(bc, mc);
+  RedisModule_FreeThreadSafeContext(ctx);
+  MR_requestCompleted();
+  MRCtx_Free(mc);
+  return REDISMODULE_OK;
+}
+
+/* Bound a second round query under a numeric SORTBY by the threshold, so the shards skip the
+ * documents outside it early. Other orders have no such filter, and are only limited to K */
+static void searchPruneBound(MRCommand *cmd, const searchRequestCtx *req, const searchResult *thr) {
+  if (!req->sortField || !thr->sortKey || !thr->sortKeyIsNum) {
+    return;
+  }
+  char buf[32];
+  size_t len = snprintf(buf, sizeof(buf), "%.17g", decodeSortKeyNum(thr->sortKeyBits));
+  MRCommand_AppendArgs(cmd, 2, "FILTER", req->sortField);
+  if (req->sortAscending) {
+    MRCommand_AppendArgs(cmd, 1, "-inf");
+    MRCommand_Append(cmd, buf, len);
+  } else {
+    MRCommand_Append(cmd, buf, len);
+    MRCommand_AppendArgs(cmd, 1, "+inf");
+  }
+}
+
+/* Reduce the first round of a search with top-K pruning, where every shard sent only its top
+ * pruneLimit results. The K-th best of them all is a threshold the global top K are within. A
+ * shard that has no more results, or whose results already passed the threshold, sent all it has
+ * within it. Only the other shards are searched again, for up to K results within the threshold */
+static int searchPruneReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  searchRequestCtx *req = MRCtx_GetPrivdata(mc);
+  // errors and timeouts are handled as in any search
+  for (int i = 0; i < count; i++) {
+    if (!replies[i] || MRReply_Type(replies[i]) != MR_REPLY_ARRAY) {
+      return searchResultReducer(mc, count, replies);
+    }
+  }
+  searchReducerCtx first = {NULL};
+  searchReducerCtx_Init(&first, req);
+  for (int i = 0; i < count; i++) {
+    processSearchReply(replies[i], &first, NULL);
+  }
+  if (count == 0 || first.errorOccured) {
+    searchReducerCtx_Clear(&first);
+    return searchResultReducer(mc, count, replies);
+  }
+  searchResult *thr = heap_count(first.pq) == heap_size(first.pq) ? heap_peek(first.pq) : NULL;
+
+  searchReplyOffsets offsets = {0};
+  getReplyOffsets(req, req->noContent, &offsets);
+  MRCommand *cmds = rm_malloc(count * sizeof(*cmds));
+  bool *complete = rm_malloc(count * sizeof(*complete));
+  size_t numCmds = 0;
+  for (int i = 0; i < count; i++) {
+    size_t len = MRReply_Length(replies[i]);
+    size_t rows = len > 0 ? (len - 1) / offsets.step : 0;
+    complete[i] = true;
+    if (rows < (size_t)req->pruneLimit) {
+      continue;
+    }
+    searchResult last;
+    newResult(&last, replies[i], 1 + (rows - 1) * offsets.step, offsets.score, offsets.payload,
+              offsets.firstField, offsets.sortKey, req->withExplainScores);
+    int slot;
+    if (!last.id || (thr && first.cmp(&last, thr, req) > 0) ||
+        MR_ShardForKey(last.id, last.keyLen, &slot) < 0) {
+      continue;
+    }
+    complete[i] = false;
+    MRCommand *cmd = &cmds[numCmds++];
+    *cmd = MRCommand_Copy(&req->pruneCmd);
+    cmd->targetSlot = slot;
+    if (thr) {
+      searchPruneBound(cmd, req, thr);
+    }
+  }
+  size_t totalReplies = first.totalReplies;
+  double totalVariance = first.totalVariance;
+  searchReducerCtx_Clear(&first);
+  if (numCmds == 0) {
+    rm_free(cmds);
+    rm_free(complete);
+    return searchResultReducer(mc, count, replies);
+  }
+
+  // the results of complete shards point into their replies, so those are kept for the merge
+  searchPruneCtx *pc = rm_calloc(1, sizeof(*pc));
+  searchReducerCtx_Init(&pc->rCtx, req);
+  pc->kept = rm_malloc(count * sizeof(*pc->kept));
+  pc->totalReplies = totalReplies;
+  pc->totalVariance = totalVariance;
+  for (int i = 0; i < count; i++) {
+    if (complete[i]) {
+      processSearchReply(replies[i], &pc->rCtx, NULL);
+      pc->kept[pc->numKept++] = replies[i];
+      replies[i] = NULL;
+    }
+  }
+  rm_free(complete);
+
+  commandArrayIterator *it = rm_malloc(sizeof(*it));
+  *it = (commandArrayIterator){.cmds = cmds, .len = numCmds, .pos = 0};
+  MRCommandGenerator cg = {.ctx = it,
+                           .Len = commandArrayIterator_Len,
+                           .Next = commandArrayIterator_Next,
+                           .Free = commandArrayIterator_Free};
+
+  struct MRCtx *roundCtx = MR_CreateCtx(NULL, pc);
+  MRCtx_SetRedisCtx(roundCtx, MRCtx_GetRedisCtx(mc));
+  MRCtx_SetReduceFunction(roundCtx, searchPruneRoundReducer);
+  MR_SetCoordinationStrategy(roundCtx, MRCluster_MastersOnly | MRCluster_FlatCoordination);
+  MR_Map(roundCtx, NULL, cg, false);
+  cg.Free(cg.ctx);
+
+  MR_requestCompleted();
+  MRCtx_Free(mc);
+  return REDISMODULE_OK;
+}
+
+/* A shard of a distributed search cursor. The results it sent that were not returned yet are
+ * buffered, and once they run short of a page the shard is asked for the results after its last.
+ * Shards that don't support SEARCHAFTER are asked for all their results up to the next page again,
+ * and as many as they already sent are skipped */
+typedef struct {
+  searchResult *results;
+  size_t pos;
+  size_t len;
+  size_t cap;
+  // a slot the shard owns, to route its commands by
+  int slot;
+  // the shard sent all of its results
+  bool exhausted;
+  // the shard was asked for more results by the current read
+  bool pending;
+  // the number of results the shard sent, and the LIMIT of the current read
+  size_t sent;
+  size_t asked;
+  // the last result the shard sent, to send as SEARCHAFTER
+  searchResult after;
+} searchCursorShard;
+
+/* The state of a distributed search between reads of its cursor */
+typedef struct {
+  uint64_t id;
+  searchRequestCtx *req;
+  searchResultCmp cmp;
+  long long totalResults;
+  double totalVariance;
+  // indexed by the shards' position in the topology
+  searchCursorShard *shards;
+  size_t numShards;
+  // the page length of the read in progress
+  size_t readCount;
+} searchCursor;
+
+static void searchCursor_Free(void *p) {
+  searchCursor *cur = p;
+  for (size_t i = 0; i < cur->numShards; i++) {
+    searchCursorShard *sh = &cur->shards[i];
+    while (sh->pos < sh->len) {
+      searchResult_ReleaseReply(&sh->results[sh->pos++]);
+    }
+    rm_free(sh->results);
+    free(sh->after.id);
+    free((char *)sh->after.sortKey);
+  }
+  rm_free(cur->shards);
+  searchRequestCtx_Free(cur->req);
+  rm_free(cur);
+}
+
+static searchCursorShard *searchCursor_Shard(searchCursor *cur, size_t idx) {
+  if (idx >= cur->numShards) {
+    cur->shards = rm_realloc(cur->shards, (idx + 1) * sizeof(*cur->shards));
+    memset(cur->shards + cur->numShards, 0, (idx + 1 - cur->numShards) * sizeof(*cur->shards));
+    // shards are known by the results they send, so the ones that sent none have no more
+    for (size_t i = cur->numShards; i <= idx; i++) {
+      cur->shards[i].exhausted = true;
+    }
+    cur->numShards = idx + 1;
+  }
+  return &cur->shards[idx];
+}
+
+static searchResult *searchCursorShard_Append(searchCursorShard *sh) {
+  // drop the returned results first, so the buffer doesn't grow with every refill
+  if (sh->pos > 0) {
+    memmove(sh->results, sh->results + sh->pos, (sh->len - sh->pos) * sizeof(*sh->results));
+    sh->len -= sh->pos;
+    sh->pos = 0;
+  }
+  if (sh->len == sh->cap) {
+    sh->cap = sh->cap ? sh->cap * 2 : SEARCH_RESULT_CHUNK_MIN;
+    sh->results = rm_realloc(sh->results, sh->cap * sizeof(*sh->results));
+  }
+  return &sh->results[sh->len++];
+}
+
+/* Keep a copy of the last result a shard sent, to continue it from */
+static void searchCursorShard_SetAfter(searchCursorShard *sh, const searchResult *last) {
+  free(sh->after.id);
+  free((char *)sh->after.sortKey);
+  memset(&sh->after, 0, sizeof(sh->after));
+  sh->after.id = strndup(last->id, last->keyLen);
+  sh->after.idLen = last->idLen;
+  sh->after.keyLen = last->keyLen;
+  sh->after.score = last->score;
+  if (last->sortKey) {
+    searchResult_SetSortKey(&sh->after, strndup(last->sortKey, last->sortKeyLen),
+                            last->sortKeyLen);
+  }
+}
+
+/* Buffer the results of a shard reply, taking the reply over. A shard that sent fewer results
+ * than it was asked for has no more. Must be called on the event loop thread */
+static void searchCursor_AddReply(searchCursor *cur, MRReply *arr, size_t requested) {
+  searchRequestCtx *req = cur->req;
+  if (!arr || MRReply_Type(arr) != MR_REPLY_ARRAY || MRReply_Length(arr) == 0) {
+    MRReply_Free(arr);
+    return;
+  }
+  searchReplyHolder *holder = malloc(sizeof(*holder));
+  holder->reply = arr;
+  holder->refcount = 1;
+
+  searchReplyOffsets offsets = {0};
+  getReplyOffsets(req, req->noContent, &offsets);
+  searchCursorShard *sh = NULL;
+  searchResult res, last;
+  size_t len = MRReply_Length(arr);
+  size_t n = 0;
+  for (size_t j = 1; j + offsets.step <= len; j += offsets.step) {
+    newResult(&res, arr, j, offsets.score, offsets.payload, offsets.firstField, offsets.sortKey,
+              req->withExplainScores);
+    if (!res.id) {
+      break;
+    }
+    if (!sh) {
+      int slot;
+      int idx = MR_ShardForKey(res.id, res.keyLen, &slot);
+      if (idx < 0) {
+        break;
+      }
+      sh = searchCursor_Shard(cur, idx);
+      sh->slot = slot;
+    }
+    last = res;
+    n++;
+    // shards that are not sent SEARCHAFTER send the results of the previous reads again first.
+    // They are skipped by position, as shards break ties by their internal doc ids
+    if (!req->forwardSearchAfter && n <= sh->sent) {
+      continue;
+    }
+    // shards that are sent SEARCHAFTER may send the results at the boundary again
+    if (req->withSearchAfter && cur->cmp(&res, &req->searchAfter, req) <= 0) {
+      continue;
+    }
+    if (req->forwardSearchAfter && sh->after.id && cur->cmp(&res, &sh->after, req) <= 0) {
+      continue;
+    }
+    res.holder = holder;
+    holder->refcount++;
+    *searchCursorShard_Append(sh) = res;
+  }
+
+  if (sh) {
+    sh->exhausted = n < (sh->asked ? sh->asked : requested);
+    sh->pending = false;
+    sh->asked = 0;
+    sh->sent = req->forwardSearchAfter ? sh->sent + n : n;
+    if (!sh->after.id || cur->cmp(&last, &sh->after, req) > 0) {
+      searchCursorShard_SetAfter(sh, &last);
+    }
   }
-  return retLen;
+  searchReplyHolder_Release(holder);
 }
 
-static void profileSearchReply(RedisModuleCtx *ctx, searchReducerCtx *rCtx,
-                               int count, MRReply **replies,
-                               clock_t totalTime, clock_t postProccesTime) {
-  RedisModule_ReplyWithArray(ctx, 2);
-  // print results
-  sendSearchResults(ctx, rCtx);
-
-  // print profile of shards
-  int arrLen = 0;
-  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-
-  arrLen += PrintShardProfile(ctx, count, replies, 1);
+/* Merge the next results of the shards' buffers into a page, after skipping some. The results of
+ * the page stay in the buffers until they are refilled */
+static size_t searchCursor_NextPage(searchCursor *cur, size_t skip, size_t count,
+                                    searchResult **page) {
+  size_t n = 0;
+  while (n < count) {
+    searchCursorShard *best = NULL;
+    for (size_t i = 0; i < cur->numShards; i++) {
+      searchCursorShard *sh = &cur->shards[i];
+      if (sh->pos < sh->len &&
+          (!best || cur->cmp(&sh->results[sh->pos], &best->results[best->pos], cur->req) < 0)) {
+        best = sh;
+      }
+    }
+    if (!best) {
+      break;
+    }
+    searchResult *res = &best->results[best->pos++];
+    if (skip) {
+      skip--;
+      searchResult_ReleaseReply(res);
+    } else {
+      page[n++] = res;
+    }
+  }
+  return n;
+}
 
-  // print coordinator stats
-  RedisModule_ReplyWithSimpleString(ctx, "Coordinator");
-  arrLen++;
-  // search cmd only do the heap so there is no parsing time
-  RedisModule_ReplyWithArray(ctx, 2);
-  RedisModule_ReplyWithSimpleString(ctx, "Total Coordinator time");
-  RedisModule_ReplyWithDouble(ctx, (double)(clock() - totalTime) / CLOCKS_PER_MILLISEC);
-  arrLen++;
+/* Reply with the next page of a cursor and its id, or 0 once it has no more results. A new cursor
+ * is opened first, a finished one is freed and any other is paused until its next read */
+static void searchCursor_Reply(RedisModuleCtx *ctx, searchCursor *cur, size_t skip, size_t count) {
+  if (!cur->id && !(cur->id = SearchCursors_Add(cur, searchCursor_Free, cur->req->cursorMaxIdle))) {
+    RedisModule_ReplyWithError(ctx, "Too many open search cursors");
+    searchCursor_Free(cur);
+    return;
+  }
+  searchResult **page = rm_malloc(MAX(count, 1) * sizeof(*page));
+  size_t n = searchCursor_NextPage(cur, skip, count, page);
 
   RedisModule_ReplyWithArray(ctx, 2);
-  RedisModule_ReplyWithSimpleString(ctx, "Post Proccessing time");
-  RedisModule_ReplyWithDouble(ctx, (double)(clock() - postProccesTime) / CLOCKS_PER_MILLISEC); 
-  arrLen++;
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  replyWithSearchTotal(ctx, cur->req, cur->totalResults, cur->totalVariance);
+  size_t len = 1;
+  for (size_t i = 0; i < n; i++) {
+    len += replyWithSearchResult(ctx, cur->req, page[i]);
+    searchResult_ReleaseReply(page[i]);
+  }
+  RedisModule_ReplySetArrayLength(ctx, len);
+  rm_free(page);
 
-  RedisModule_ReplySetArrayLength(ctx, arrLen);
+  bool done = true;
+  for (size_t i = 0; i < cur->numShards; i++) {
+    done = done && cur->shards[i].exhausted && cur->shards[i].pos == cur->shards[i].len;
+  }
+  RedisModule_ReplyWithLongLong(ctx, done ? 0 : cur->id);
+  if (done) {
+    SearchCursors_Free(cur->id);
+  } else {
+    SearchCursors_Pause(cur->id);
+  }
 }
 
-static int searchResultReducer(struct MRCtx *mc, int count, MRReply **replies) {
-  clock_t postProccesTime;
+/* Reduce the first round of a cursor search: every shard sent its first offset + count results */
+static int searchCursorReducer(struct MRCtx *mc, int count, MRReply **replies) {
   RedisModuleBlockedClient *bc = (RedisModuleBlockedClient *)MRCtx_GetRedisCtx(mc);
   RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(bc);
   searchRequestCtx *req = MRCtx_GetPrivdata(mc);
-  searchReducerCtx rCtx = {NULL};
-  int profile = (req->profileArgs > 0);
 
-  // got no replies - this means timeout
-  if (count == 0 || req->limit < 0) {
-    int res = RedisModule_ReplyWithError(ctx, "Could not send query to cluster");
-    RedisModule_UnblockClient(bc, mc);
-    RedisModule_FreeThreadSafeContext(ctx);
-    MR_requestCompleted();
-    MRCtx_Free(mc);
-    return res;
+  MRReply *err = NULL;
+  for (int i = 0; i < count && !err; i++) {
+    if (replies[i] && MRReply_Type(replies[i]) == MR_REPLY_ERROR) {
+      err = replies[i];
+    }
   }
-
-  if (MRReply_Type(*replies) == MR_REPLY_ERROR) {
-    int res = MR_ReplyWithMRReply(ctx, *replies);
-    RedisModule_UnblockClient(bc, mc);
-    RedisModule_FreeThreadSafeContext(ctx);
-    MR_requestCompleted();
-    MRCtx_Free(mc);
-    return res;
+  if (count == 0 || err) {
+    if (err) {
+      MR_ReplyWithMRReply(ctx, err);
+    } else {
+      RedisModule_ReplyWithError(ctx, "Could not send query to cluster");
+    }
+    searchRequestCtx_Free(req);
+  } else {
+    searchCursor *cur = rm_calloc(1, sizeof(*cur));
+    cur->req = req;
+    cur->cmp = searchResultCmpFor(req);
+    for (int i = 0; i < count; i++) {
+      if (MRReply_Type(replies[i]) == MR_REPLY_ARRAY && MRReply_Length(replies[i]) > 0) {
+        long long total = MRReply_Integer(MRReply_ArrayElement(replies[i], 0));
+        cur->totalResults += total;
+        cur->totalVariance += searchTotalVariance(req, total);
+      }
+      // the buffered results point into the replies, so the cursor takes them over
+      searchCursor_AddReply(cur, replies[i], req->offset + req->cursorCount);
+      replies[i] = NULL;
+    }
+    searchCursor_Reply(ctx, cur, req->offset, req->cursorCount);
   }
 
-  size_t num = req->offset + req->limit;
-  rCtx.pq = rm_malloc(heap_sizeof(num));
-  heap_init(rCtx.pq, cmp_results, req, num);
+  RedisModule_UnblockClient(bc, mc);
+  RedisModule_FreeThreadSafeContext(ctx);
+  MR_requestCompleted();
+  MRCtx_Free(mc);
+  return REDISMODULE_OK;
+}
 
-  rCtx.searchCtx = req;
+/* Reduce the refills of a cursor read, and reply with its page */
+static int searchCursorReadReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  RedisModuleBlockedClient *bc = (RedisModuleBlockedClient *)MRCtx_GetRedisCtx(mc);
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(bc);
+  searchCursor *cur = MRCtx_GetPrivdata(mc);
 
-  for (int i = 0; i < count; i++) {
-    MRReply *reply = (!profile) ? replies[i] : MRReply_ArrayElement(replies[i], 0);
-    processSearchReply(reply, &rCtx, ctx);
-  }
-  if (rCtx.cachedResult) {
-    free(rCtx.cachedResult);
+  MRReply *err = NULL;
+  for (int i = 0; i < count && !err; i++) {
+    if (replies[i] && MRReply_Type(replies[i]) == MR_REPLY_ERROR) {
+      err = replies[i];
+    }
   }
-  // If we didn't get any results and we got an error - return it.
-  // If some shards returned results and some errors - we prefer to show the results we got an not
-  // return an error. This might change in the future
-  if ((rCtx.totalReplies == 0 && rCtx.lastError != NULL) || rCtx.errorOccured) {
-    if (rCtx.lastError) {
-      MR_ReplyWithMRReply(ctx, rCtx.lastError);
+  if (err || count < MRCtx_GetCmdsSize(mc)) {
+    // the positions of the shards that failed are unknown now, so the cursor can't go on
+    if (err) {
+      MR_ReplyWithMRReply(ctx, err);
     } else {
-      RedisModule_ReplyWithError(ctx, "could not parse redisearch results");
+      RedisModule_ReplyWithError(ctx, "Could not read from all shards");
     }
-    goto cleanup;
-  }
-  
-  if (!profile) {
-    sendSearchResults(ctx, &rCtx);
+    SearchCursors_Free(cur->id);
   } else {
-    postProccesTime = clock();
-    profileSearchReply(ctx, &rCtx, count, replies, req->profileClock, postProccesTime);
-  }
-cleanup:
-  if (rCtx.pq) {
-    searchResult *res;
-    while ((res = heap_poll(rCtx.pq))) {
-      free(res);
+    for (int i = 0; i < count; i++) {
+      searchCursor_AddReply(cur, replies[i], cur->readCount);
+      replies[i] = NULL;
+    }
+    // a shard that was asked for more results but sent none has no more
+    for (size_t i = 0; i < cur->numShards; i++) {
+      if (cur->shards[i].pending) {
+        cur->shards[i].pending = false;
+        cur->shards[i].exhausted = true;
+      }
     }
-    heap_free(rCtx.pq);
+    searchCursor_Reply(ctx, cur, 0, cur->readCount);
   }
 
-  searchRequestCtx_Free(req);
   RedisModule_UnblockClient(bc, mc);
   RedisModule_FreeThreadSafeContext(ctx);
   MR_requestCompleted();
@@ -849,6 +1774,141 @@ cleanup:
   return REDISMODULE_OK;
 }
 
+/* The query for the next results of a shard, after the last one it sent, or up to them if the
+ * shard doesn't support SEARCHAFTER */
+static MRCommand searchCursorShard_Command(searchCursor *cur, searchCursorShard *sh,
+                                           size_t count) {
+  searchRequestCtx *req = cur->req;
+  MRCommand cmd = MRCommand_Copy(&req->cursorCmd);
+  cmd.targetSlot = sh->slot;
+  sh->asked = req->forwardSearchAfter ? count : sh->sent + count;
+  char buf[32];
+  MRCommand_AppendArgs(&cmd, 2, "LIMIT", "0");
+  MRCommand_Append(&cmd, buf, snprintf(buf, sizeof(buf), "%zu", sh->asked));
+  if (req->forwardSearchAfter) {
+    MRCommand_AppendArgs(&cmd, 1, "SEARCHAFTER");
+    if (req->withSortby) {
+      const char *value = sh->after.sortKey ? sh->after.sortKey : "";
+      MRCommand_Append(&cmd, value, sh->after.sortKey ? sh->after.sortKeyLen : 0);
+    } else {
+      MRCommand_Append(&cmd, buf, snprintf(buf, sizeof(buf), "%.17g", sh->after.score));
+    }
+    MRCommand_Append(&cmd, sh->after.id, sh->after.keyLen);
+  }
+  return cmd;
+}
+
+/* Read the next page of a taken cursor. Only the shards whose buffers can't fill the page are
+ * queried, and the client is blocked until they reply */
+static void searchCursor_Read(RedisModuleCtx *ctx, searchCursor *cur, size_t count) {
+  // shards that are not sent SEARCHAFTER are asked for all the results they sent again
+  for (size_t i = 0; i < cur->numShards && !cur->req->forwardSearchAfter; i++) {
+    searchCursorShard *sh = &cur->shards[i];
+    if (!sh->exhausted && sh->len - sh->pos < count &&
+        sh->sent + count > SEARCH_CURSOR_MAX_ROWS) {
+      RedisModule_ReplyWithError(ctx, "Search cursor read past its maximal number of results");
+      SearchCursors_Free(cur->id);
+      return;
+    }
+  }
+  MRCommand *cmds = rm_malloc(MAX(cur->numShards, 1) * sizeof(*cmds));
+  size_t numCmds = 0;
+  for (size_t i = 0; i < cur->numShards; i++) {
+    searchCursorShard *sh = &cur->shards[i];
+    sh->pending = !sh->exhausted && sh->len - sh->pos < count;
+    if (sh->pending) {
+      cmds[numCmds++] = searchCursorShard_Command(cur, sh, count);
+    }
+  }
+  if (numCmds == 0) {
+    rm_free(cmds);
+    searchCursor_Reply(ctx, cur, 0, count);
+    return;
+  }
+
+  cur->readCount = count;
+  commandArrayIterator *it = rm_malloc(sizeof(*it));
+  *it = (commandArrayIterator){.cmds = cmds, .len = numCmds, .pos = 0};
+  MRCommandGenerator cg = {.ctx = it,
+                           .Len = commandArrayIterator_Len,
+                           .Next = commandArrayIterator_Next,
+                           .Free = commandArrayIterator_Free};
+
+  struct MRCtx *mc = MR_CreateCtx(NULL, cur);
+  MRCtx_SetRedisCtx(mc, RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0));
+  MRCtx_SetReduceFunction(mc, searchCursorReadReducer);
+  MR_SetCoordinationStrategy(mc, MRCluster_MastersOnly | MRCluster_FlatCoordination);
+  MR_Map(mc, NULL, cg, false);
+  cg.Free(cg.ctx);
+}
+
+/* Remove the options of a search command that the shards don't get: APPROXCOUNT unless it is
+ * forwarded, and with withCursor the cursor and paging options, as the cursor sets its own. Only
+ * the arguments the request was parsed from are removed, so fields and parameters that share
+ * their names are kept */
+static void searchStripShardArgs(MRCommand *cmd, const searchRequestCtx *req, int argc,
+                                 int withCursor) {
+  struct argSpan {
+    int start;
+    int len;
+  } opts[] = {{withCursor ? req->cursorIndex : 0, 1},
+              {withCursor ? req->cursorCountIndex : 0, 2},
+              {withCursor ? req->cursorMaxIdleIndex : 0, 2},
+              {withCursor ? req->limitIndex : 0, 3},
+              {withCursor && req->withSearchAfter ? req->searchAfterIndex : 0, 3},
+              {req->forwardApproxCount ? 0 : req->approxCountIndex, 2}};
+  const int numOpts = sizeof(opts) / sizeof(*opts);
+  // sort by position, the ones that are not given are at 0
+  for (int i = 1; i < numOpts; i++) {
+    for (int j = i; j > 0 && opts[j - 1].start > opts[j].start; j--) {
+      struct argSpan tmp = opts[j];
+      opts[j] = opts[j - 1];
+      opts[j - 1] = tmp;
+    }
+  }
+  // remove from the last one, so the positions of the others stay valid
+  int end = argc;
+  for (int i = numOpts - 1; i >= 0 && opts[i].start > 0; i--) {
+    if (opts[i].start + opts[i].len <= end) {
+      MRCommand_RemoveArgs(cmd, opts[i].start, opts[i].len);
+      end = opts[i].start;
+    }
+  }
+}
+
+/* Serve FT.CURSOR READ and DEL for search cursors. Returns 0 if the cursor is not one of them */
+static int searchCursorCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  long long id;
+  bool isRead = RMUtil_StringEqualsCaseC(argv[1], "READ");
+  if ((!isRead && !RMUtil_StringEqualsCaseC(argv[1], "DEL")) ||
+      RedisModule_StringToLongLong(argv[3], &id) != REDISMODULE_OK || id <= 0) {
+    return 0;
+  }
+  searchCursor *cur = SearchCursors_Take(id);
+  if (!cur) {
+    return 0;
+  }
+  if (!RMUtil_StringEqualsC(argv[2], cur->req->cursorCmd.strs[1])) {
+    SearchCursors_Pause(id);
+    return 0;
+  }
+
+  if (!isRead) {
+    SearchCursors_Free(id);
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+    return 1;
+  }
+  long long count = cur->req->cursorCount;
+  RMUtil_ParseArgsAfter("COUNT", argv + 4, argc - 4, "l", &count);
+  if (count > SEARCH_CURSOR_MAX_ROWS) {
+    SearchCursors_Pause(id);
+    RedisModule_ReplyWithError(ctx, "Search cursor COUNT is too large");
+    return 1;
+  }
+  searchCursor_Read(ctx, cur, count > 0 ? count : cur->req->cursorCount);
+  return 1;
+}
+
 int FirstPartitionCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
                                  MRReduceFunc reducer, struct MRCtx *mrCtx) {
 
@@ -947,14 +2007,63 @@ int MGetCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
   MRCommand cmd = MR_NewCommandFromRedisStrings(argc, argv);
   /* Replace our own FT command with _FT. command */
   MRCommand_SetPrefix(&cmd, "_FT");
-//  for (int i = 2; i < argc; i++) {
-//    SearchCluster_RewriteCommandArg(GetSearchCluster(), &cmd, i, i);
-//  }
 
-  MRCommandGenerator cg = SearchCluster_MultiplexCommand(GetSearchCluster(), &cmd);
+  // every shard is only asked for the keys it owns
   struct MRCtx *mrctx = MR_CreateCtx(ctx, NULL);
   MR_SetCoordinationStrategy(mrctx, MRCluster_MastersOnly | MRCluster_FlatCoordination);
-  MR_Map(mrctx, mergeArraysReducer, cg, true);
+  MR_MapKeys(mrctx, mgetReducer, cmd, 2, true);
+  return REDISMODULE_OK;
+}
+
+/* FT.MADD {idx} {nargs} {docId} {score} ... [{nargs} {docId} {score} ...]
+ * Adds many documents in one request, each given by the FT.ADD arguments that follow the index
+ * name, prefixed by their count. Every document is sent to its shard as an _FT.ADD, the documents
+ * of a shard are pipelined on its connection, and the statuses are replied in input order */
+int MAddCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+
+  if (argc < 5) {
+    return RedisModule_WrongArity(ctx);
+  }
+  // Check that the cluster state is valid
+  if (!SearchCluster_Ready(GetSearchCluster())) {
+    return RedisModule_ReplyWithError(ctx, CLUSTERDOWN_ERR);
+  }
+  RedisModule_AutoMemory(ctx);
+
+  // validate all the documents before sending any of them
+  size_t numDocs = 0;
+  for (int i = 2; i < argc; numDocs++) {
+    long long nargs;
+    if (RedisModule_StringToLongLong(argv[i], &nargs) != REDISMODULE_OK || nargs < 2 ||
+        nargs > argc - i - 1) {
+      return RedisModule_ReplyWithError(ctx, "Invalid document arguments count");
+    }
+    i += nargs + 1;
+  }
+
+  const char *idx = RedisModule_StringPtrLen(argv[1], NULL);
+  MRCommand *cmds = rm_malloc(numDocs * sizeof(*cmds));
+  for (int i = 2, n = 0; i < argc; n++) {
+    long long nargs;
+    RedisModule_StringToLongLong(argv[i++], &nargs);
+    cmds[n] = MR_NewCommand(2, "_FT.ADD", idx);
+    for (int j = 0; j < nargs; j++, i++) {
+      size_t len;
+      const char *arg = RedisModule_StringPtrLen(argv[i], &len);
+      MRCommand_Append(&cmds[n], arg, len);
+    }
+  }
+
+  commandArrayIterator *it = rm_malloc(sizeof(*it));
+  *it = (commandArrayIterator){.cmds = cmds, .len = numDocs, .pos = 0};
+  MRCommandGenerator cg = {.ctx = it,
+                           .Len = commandArrayIterator_Len,
+                           .Next = commandArrayIterator_Next,
+                           .Free = commandArrayIterator_Free};
+
+  struct MRCtx *mrctx = MR_CreateCtx(ctx, NULL);
+  MRCtx_SetOrderedReplies(mrctx);
+  MR_Map(mrctx, maddReducer, cg, true);
   cg.Free(cg.ctx);
   return REDISMODULE_OK;
 }
@@ -1061,6 +2170,9 @@ static int CursorCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc
   if (!SearchCluster_Ready(GetSearchCluster())) {
     return RedisModule_ReplyWithError(ctx, CLUSTERDOWN_ERR);
   }
+  if (searchCursorCommand(ctx, argv, argc)) {
+    return REDISMODULE_OK;
+  }
   return ConcurrentSearch_HandleRedisCommandEx(DIST_AGG_THREADPOOL, CMDCTX_NO_GIL,
                                                CursorCommandInternal, ctx, argv, argc);
 }
@@ -1148,6 +2260,10 @@ int LocalSearchCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int
   if (!req) {
     return RedisModule_ReplyWithError(ctx, "Invalid search request");
   }
+  if (req->withSearchAfter && !req->forwardSearchAfter) {
+    searchRequestCtx_Free(req);
+    return RedisModule_ReplyWithError(ctx, SEARCHAFTER_DISABLED_ERR);
+  }
 
   MRCommand cmd = MR_NewCommandFromRedisStrings(argc, argv);
 
@@ -1156,6 +2272,7 @@ int LocalSearchCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int
   if (limitIndex && req->limit > 0 && limitIndex < argc - 2) {
     MRCommand_ReplaceArg(&cmd, limitIndex + 1, "0", 1);
   }
+  searchStripShardArgs(&cmd, req, argc, 0);
 
   /* Replace our own DFT command with FT. command */
   MRCommand_ReplaceArg(&cmd, 0, "_FT.SEARCH", sizeof("_FT.SEARCH") - 1);
@@ -1174,6 +2291,7 @@ int LocalSearchCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int
   // we prefer the next level to be local - we will only approach nodes on our own shard
   // we also ask only masters to serve the request, to avoid duplications by random
   MR_SetCoordinationStrategy(mrctx, MRCluster_LocalCoordination | MRCluster_MastersOnly);
+  MRCtx_SetReplyFold(mrctx, searchReplyFold);
 
   MR_Map(mrctx, searchResultReducer, cg, true);
   cg.Free(cg.ctx);
@@ -1185,26 +2303,37 @@ int FlatSearchCommandHandler(RedisModuleBlockedClient *bc, RedisModuleString **a
   RedisModule_AutoMemory(ctx);
 
   searchRequestCtx *req = rscParseRequest(argv, argc);
+  const char *err = NULL;
   if (!req) {
+    err = "Invalid search request";
+  } else if (req->withSearchAfter && !req->forwardSearchAfter) {
+    err = SEARCHAFTER_DISABLED_ERR;
+    searchRequestCtx_Free(req);
+  }
+  if (err) {
     RedisModuleCtx* clientCtx = RedisModule_GetThreadSafeContext(bc);
-    RedisModule_ReplyWithError(clientCtx, "Invalid search request");
+    RedisModule_ReplyWithError(clientCtx, err);
     RedisModule_UnblockClient(bc, NULL);
     RedisModule_FreeThreadSafeContext(clientCtx);
     RedisModule_FreeThreadSafeContext(ctx);
     return REDISMODULE_OK;
   }
 
-  MRCommand cmd = MR_NewCommandFromRedisStrings(argc, argv);
+  // the command borrows the held arguments until it is handed over to the event loop
+  MRCommand cmd = MR_NewCommandBorrowingStrings(argc, argv);
 
   // replace the LIMIT {offset} {limit} with LIMIT 0 {limit}, because we need all top N to merge
   int limitIndex = RMUtil_ArgExists("LIMIT", argv, argc, 3);
-  if (limitIndex && req->limit > 0 && limitIndex < argc - 2) {
+  if (!req->withCursor && limitIndex && req->limit > 0 && limitIndex < argc - 2) {
     MRCommand_ReplaceArg(&cmd, limitIndex + 1, "0", 1);
     char buf[32];
     snprintf(buf, sizeof(buf), "%lld", req->limit + req->offset);
     MRCommand_ReplaceArg(&cmd, limitIndex + 2, buf, strlen(buf));
   }
 
+  // a cursor sends its own LIMIT to the shards with every read
+  searchStripShardArgs(&cmd, req, argc, req->withCursor);
+
   /* Replace our own FT command with _FT. command */
   if (req->profileArgs == 0) {
     MRCommand_ReplaceArg(&cmd, 0, "_FT.SEARCH", sizeof("_FT.SEARCH") - 1);
@@ -1222,13 +2351,69 @@ int FlatSearchCommandHandler(RedisModuleBlockedClient *bc, RedisModuleString **a
     // req->withSortingKeys = 1;
   }
 
+  // with two-phase search the shards only send ids and scores, and the content is fetched by
+  // searchFetchContent once the returned page is known
+  req->twoPhase = clusterConfig.twoPhaseSearch && !req->noContent && req->limit > 0 &&
+                  req->profileArgs == 0 && !req->withCursor &&
+                  !RMUtil_ArgExists("INKEYS", argv, argc, 3);
+  if (req->twoPhase) {
+    req->contentCmd = MRCommand_Copy(&cmd);
+    MRCommand_AppendArgsAtPos(&cmd, 3, 1, "NOCONTENT");
+  }
+
+  // with top-K pruning the shards first send a share of the page each, to find the threshold that
+  // only the shards holding more of the top results are searched again with
+  size_t numShards = MAX(GetSearchCluster()->size, 1);
+  long long topK = req->offset + req->limit;
+  req->pruneLimit = (SEARCH_PRUNE_OVERSAMPLE * topK + numShards - 1) / numShards;
+  req->topkPruning = clusterConfig.topkPruning && req->limit > 0 && req->pruneLimit < topK &&
+                     req->profileArgs == 0 && !req->twoPhase && !req->withCursor;
+  if (req->topkPruning) {
+    req->pruneCmd = MRCommand_Copy(&cmd);
+    searchSetShardLimit(&cmd, req->pruneLimit);
+    int sortByIndex = RMUtil_ArgIndex("SORTBY", argv, argc);
+    if (req->withSortby && sortByIndex + 1 < argc) {
+      req->sortField = strdup(RedisModule_StringPtrLen(argv[sortByIndex + 1], NULL));
+    }
+  }
+
+  // the first round of a cursor fetches its first page, later reads continue each shard from
+  // the last result it sent
+  if (req->withCursor) {
+    req->cursorCmd = MRCommand_Copy(&cmd);
+    char buf[32];
+    MRCommand_AppendArgs(&cmd, 2, "LIMIT", "0");
+    MRCommand_Append(&cmd, buf, snprintf(buf, sizeof(buf), "%lld", req->offset + req->cursorCount));
+    if (req->withSearchAfter) {
+      int afterIndex = req->searchAfterIndex;
+      MRCommand_AppendArgs(&cmd, 1, "SEARCHAFTER");
+      for (int i = afterIndex + 1; i <= afterIndex + 2; i++) {
+        size_t len;
+        const char *arg = RedisModule_StringPtrLen(argv[i], &len);
+        MRCommand_Append(&cmd, arg, len);
+      }
+    }
+  }
+
   struct MRCtx *mrctx = MR_CreateCtx(ctx, req);
   // we prefer the next level to be local - we will only approach nodes on our own shard
   // we also ask only masters to serve the request, to avoid duplications by random
   MR_SetCoordinationStrategy(mrctx, MRCluster_FlatCoordination);
 
-  MRCtx_SetReduceFunction(mrctx, searchResultReducer);
+  if (req->withCursor) {
+    MRCtx_SetReduceFunction(mrctx, searchCursorReducer);
+  } else if (req->topkPruning) {
+    MRCtx_SetReduceFunction(mrctx, searchPruneReducer);
+  } else {
+    MRCtx_SetReduceFunction(mrctx, searchResultReducer);
+  }
+  // profile replies are kept whole, so the shards' profiles can be printed with the results,
+  // cursors keep them for the following pages, and pruning looks at the first round replies whole
+  if (req->profileArgs == 0 && !req->withCursor && !req->topkPruning) {
+    MRCtx_SetReplyFold(mrctx, searchReplyFold);
+  }
   MRCtx_SetRedisCtx(mrctx, bc);
+  MRCommand_CopyBorrowed(&cmd);
   MR_Fanout(mrctx, NULL, cmd, false);
   RedisModule_FreeThreadSafeContext(ctx);
   return REDISMODULE_OK;
@@ -1312,6 +2497,23 @@ int ClusterInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
       ctx, clusterConfig.type == ClusterType_RedisLabs ? "redislabs" : "redis_oss");
   n++;
 
+  RedisModule_ReplyWithSimpleString(ctx, "ready");
+  n++;
+  RedisModule_ReplyWithLongLong(ctx, MR_IsReady());
+  n++;
+
+  // Report reply compression
+  MRReplyCompressionStats cs = MRReply_GetCompressionStats();
+  RedisModule_ReplyWithSimpleString(ctx, "compressed_replies");
+  n++;
+  RedisModule_ReplyWithLongLong(ctx, cs.numReplies);
+  n++;
+  RedisModule_ReplyWithSimpleString(ctx, "reply_compression_ratio");
+  n++;
+  RedisModule_ReplyWithDouble(
+      ctx, cs.compressedBytes ? (double)cs.inflatedBytes / cs.compressedBytes : 0);
+  n++;
+
   // Report hash func
   MRClusterTopology *topo = MR_GetCurrentTopology();
   RedisModule_ReplyWithSimpleString(ctx, "hash_func");
@@ -1369,6 +2571,98 @@ int UnsuportedOnCluster(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
   return RedisModule_ReplyWithError(ctx, "Command not supported on cluster");
 }
 
+/* The last topology we persisted, so we only rewrite the snapshot file when it changes */
+static sds lastTopologySnapshot_g = NULL;
+
+/* Persist the topology to the snapshot file, if configured. The file is written to a temporary
+ * file first and renamed, so a crash never leaves a partial snapshot behind */
+static void saveTopologySnapshot(RedisModuleCtx *ctx, MRClusterTopology *topo) {
+  if (!clusterConfig.topologySnapshot || !MRClusterTopology_IsValid(topo)) {
+    return;
+  }
+
+  sds snap = MRClusterTopology_Serialize(topo);
+  if (lastTopologySnapshot_g && !sdscmp(snap, lastTopologySnapshot_g)) {
+    sdsfree(snap);
+    return;
+  }
+
+  sds tmp = sdscatprintf(sdsempty(), "%s.tmp", clusterConfig.topologySnapshot);
+  // the snapshot may contain shard passwords
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  int ok = fd >= 0;
+  for (size_t off = 0; ok && off < sdslen(snap);) {
+    ssize_t n = write(fd, snap + off, sdslen(snap) - off);
+    ok = n > 0;
+    off += ok ? n : 0;
+  }
+  if (fd >= 0) {
+    ok = fsync(fd) == 0 && ok;
+    close(fd);
+  }
+  if (ok && rename(tmp, clusterConfig.topologySnapshot) == 0) {
+    sdsfree(lastTopologySnapshot_g);
+    lastTopologySnapshot_g = snap;
+  } else {
+    RedisModule_Log(ctx, "warning", "Could not save topology snapshot to %s",
+                    clusterConfig.topologySnapshot);
+    unlink(tmp);
+    sdsfree(snap);
+  }
+  sdsfree(tmp);
+}
+
+/* Load the last persisted topology from the snapshot file, if configured. Returns NULL if there is
+ * no valid snapshot */
+static MRClusterTopology *loadTopologySnapshot(RedisModuleCtx *ctx) {
+  if (!clusterConfig.topologySnapshot) {
+    return NULL;
+  }
+  FILE *fp = fopen(clusterConfig.topologySnapshot, "r");
+  if (!fp) {
+    return NULL;
+  }
+  sds buf = sdsempty();
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+    buf = sdscatlen(buf, chunk, n);
+  }
+  fclose(fp);
+
+  MRClusterTopology *topo = MRClusterTopology_Deserialize(buf, sdslen(buf));
+  if (topo && !MRClusterTopology_IsValid(topo)) {
+    MRClusterTopology_Free(topo);
+    topo = NULL;
+  }
+  if (!topo) {
+    RedisModule_Log(ctx, "warning", "Ignoring invalid topology snapshot %s",
+                    clusterConfig.topologySnapshot);
+    sdsfree(buf);
+    return NULL;
+  }
+  lastTopologySnapshot_g = buf;
+  return topo;
+}
+
+/* Set the partition slot table for the topology's hash function, if it has one */
+static void setTopologySlotTable(MRClusterTopology *topo) {
+  switch (topo->hashFunc) {
+    case MRHashFunc_CRC12:
+      PartitionCtx_SetSlotTable(&GetSearchCluster()->part, crc12_slot_table,
+                                MIN(4096, topo->numSlots));
+      break;
+    case MRHashFunc_CRC16:
+      PartitionCtx_SetSlotTable(&GetSearchCluster()->part, crc16_slot_table,
+                                MIN(16384, topo->numSlots));
+      break;
+    case MRHashFunc_None:
+    default:
+      // do nothing
+      break;
+  }
+}
+
 // A special command for redis cluster OSS, that refreshes the cluster state
 int RefreshClusterCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
@@ -1376,6 +2670,9 @@ int RefreshClusterCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
   MRClusterTopology *topo = RedisCluster_GetTopology(ctx);
 
   SearchCluster_EnsureSize(ctx, GetSearchCluster(), topo);
+  if (topo) {
+    saveTopologySnapshot(ctx, topo);
+  }
 
   MR_UpdateTopology(topo);
   RedisModule_ReplyWithSimpleString(ctx, "OK");
@@ -1393,20 +2690,8 @@ int SetClusterCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
   SearchCluster_EnsureSize(ctx, GetSearchCluster(), topo);
   // If the cluster hash func or cluster slots has changed, set the new value
-  switch (topo->hashFunc) {
-    case MRHashFunc_CRC12:
-      PartitionCtx_SetSlotTable(&GetSearchCluster()->part, crc12_slot_table,
-                                MIN(4096, topo->numSlots));
-      break;
-    case MRHashFunc_CRC16:
-      PartitionCtx_SetSlotTable(&GetSearchCluster()->part, crc16_slot_table,
-                                MIN(16384, topo->numSlots));
-      break;
-    case MRHashFunc_None:
-    default:
-      // do nothing
-      break;
-  }
+  setTopologySlotTable(topo);
+  saveTopologySnapshot(ctx, topo);
 
   // send the topology to the cluster
   if (MR_UpdateTopology(topo) != REDISMODULE_OK) {
@@ -1457,8 +2742,19 @@ int initSearchCluster(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
   MRCluster *cl = MR_NewCluster(initialTopology, sf, 2);
   MR_Init(cl, clusterConfig.timeoutMS);
+  MR_RunEvery(SEARCH_CURSORS_SWEEP_INTERVAL_MS, SearchCursors_Sweep, NULL);
   InitGlobalSearchCluster(clusterConfig.numPartitions, slotTable, tableSize);
 
+  /* Start from the last known topology, so we can serve commands before the first CLUSTERSET or
+   * CLUSTERREFRESH. Updating the topology also opens the connections to all nodes */
+  MRClusterTopology *snapshot = loadTopologySnapshot(ctx);
+  if (snapshot) {
+    RedisModule_Log(ctx, "notice", "Loaded topology snapshot with %zu shards", snapshot->numShards);
+    SearchCluster_EnsureSize(ctx, GetSearchCluster(), snapshot);
+    setTopologySlotTable(snapshot);
+    MR_UpdateTopology(snapshot);
+  }
+
   return REDISMODULE_OK;
 }
 
@@ -1624,6 +2920,7 @@ RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_Log(ctx, "notice", "Register write commands");
     // write commands (on enterprise we do not define them, the dmc take care of them)
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.ADD", SafeCmd(SingleShardCommandHandler), "readonly", 0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT.MADD", SafeCmd(MAddCommandHandler), "readonly", 0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.DEL", SafeCmd(SingleShardCommandHandler), "readonly", 0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.CREATE", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT._CREATEIFNX", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
@@ -312,6 +312,12 @@ int SCCommandMuxIterator_Next(void *ctx, MRCommand *cmd) {
     size_t taggedLen;
     char *tagged = writeTaggedId(arg, argLen, tag, strlen(tag), &taggedLen);
     MRCommand_ReplaceArgNoDup(cmd, it->keyOffset, tagged, taggedLen);
+
+    // serialize the rest of the command once, and only format the tagged key per partition
+    if (!it->tmpl.prefix) {
+      MRCommandTemplate_Init(&it->tmpl, it->cmd, it->keyOffset);
+    }
+    cmd->cmd = MRCommandTemplate_Format(&it->tmpl, tagged, taggedLen);
   }
   // MRCommand_Print(cmd);
 
@@ -333,6 +339,7 @@ void SCCommandMuxIterator_Free(void *ctx) {
   SCCommandMuxIterator *it = ctx;
   if (it->cmd) MRCommand_Free(it->cmd);
   it->cmd = NULL;
+  MRCommandTemplate_Free(&it->tmpl);
   free(it->keyAlias);
   free(it);
 }
@@ -29,6 +29,9 @@ typedef struct {
   int keyOffset;
   size_t offset;
   SearchCluster *cluster;
+  /* The command serialized once for all partitions, with the key left to be tagged. Built on the
+   * first iteration */
+  MRCommandTemplate tmpl;
 } SCCommandMuxIterator;
 
 int SearchCluster_Ready(SearchCluster *sc);
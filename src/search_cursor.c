@@ -0,0 +1,139 @@
+#include "search_cursor.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+  uint64_t id;
+  void *state;
+  SearchCursorFreeFunc freeState;
+  long long maxIdle;
+  long long deadline;  // when a paused cursor expires, in monotonic ms
+  bool taken;
+} searchCursorEntry;
+
+/* Cursors are added and freed on the event loop thread and read on the main thread, so the table is
+ * guarded by a lock. It is small enough to be scanned on every operation */
+static searchCursorEntry cursors_g[SEARCH_CURSORS_MAX];
+static size_t numCursors_g = 0;
+static pthread_mutex_t cursorsLock_g = PTHREAD_MUTEX_INITIALIZER;
+
+static long long nowMS(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void removeEntry(size_t i) {
+  cursors_g[i] = cursors_g[--numCursors_g];
+}
+
+/* Remove the paused cursors that were idle for too long into expired, which has room for all the
+ * cursors, and return their number. Must be called with the lock held, and the states freed with
+ * freeExpired once it is released */
+static size_t collectExpired(searchCursorEntry *expired) {
+  long long now = nowMS();
+  size_t n = 0;
+  for (size_t i = 0; i < numCursors_g;) {
+    searchCursorEntry *e = &cursors_g[i];
+    if (!e->taken && e->deadline <= now) {
+      expired[n++] = *e;
+      removeEntry(i);
+    } else {
+      i++;
+    }
+  }
+  return n;
+}
+
+static void freeExpired(searchCursorEntry *expired, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    expired[i].freeState(expired[i].state);
+  }
+}
+
+static searchCursorEntry *findEntry(uint64_t id) {
+  for (size_t i = 0; i < numCursors_g; i++) {
+    if (cursors_g[i].id == id) return &cursors_g[i];
+  }
+  return NULL;
+}
+
+/* A random positive id that fits in a redis integer reply */
+static uint64_t newId(void) {
+  uint64_t id;
+  do {
+    id = (((uint64_t)rand() << 32) ^ (uint64_t)rand()) & INT64_MAX;
+  } while (id == 0 || findEntry(id));
+  return id;
+}
+
+uint64_t SearchCursors_Add(void *state, SearchCursorFreeFunc freeState, long long maxIdleMS) {
+  uint64_t id = 0;
+  searchCursorEntry expired[SEARCH_CURSORS_MAX];
+  pthread_mutex_lock(&cursorsLock_g);
+  size_t numExpired = collectExpired(expired);
+  if (numCursors_g < SEARCH_CURSORS_MAX) {
+    id = newId();
+    cursors_g[numCursors_g++] = (searchCursorEntry){
+        .id = id, .state = state, .freeState = freeState, .maxIdle = maxIdleMS, .taken = true};
+  }
+  pthread_mutex_unlock(&cursorsLock_g);
+  freeExpired(expired, numExpired);
+  return id;
+}
+
+void *SearchCursors_Take(uint64_t id) {
+  void *state = NULL;
+  searchCursorEntry expired[SEARCH_CURSORS_MAX];
+  pthread_mutex_lock(&cursorsLock_g);
+  size_t numExpired = collectExpired(expired);
+  searchCursorEntry *e = findEntry(id);
+  if (e && !e->taken) {
+    e->taken = true;
+    state = e->state;
+  }
+  pthread_mutex_unlock(&cursorsLock_g);
+  freeExpired(expired, numExpired);
+  return state;
+}
+
+void SearchCursors_Pause(uint64_t id) {
+  pthread_mutex_lock(&cursorsLock_g);
+  searchCursorEntry *e = findEntry(id);
+  if (e) {
+    e->taken = false;
+    e->deadline = nowMS() + e->maxIdle;
+  }
+  pthread_mutex_unlock(&cursorsLock_g);
+}
+
+void SearchCursors_Free(uint64_t id) {
+  void *state = NULL;
+  SearchCursorFreeFunc freeState = NULL;
+  pthread_mutex_lock(&cursorsLock_g);
+  searchCursorEntry *e = findEntry(id);
+  if (e) {
+    state = e->state;
+    freeState = e->freeState;
+    removeEntry(e - cursors_g);
+  }
+  pthread_mutex_unlock(&cursorsLock_g);
+  if (freeState) freeState(state);
+}
+
+void SearchCursors_Sweep(void *unused) {
+  searchCursorEntry expired[SEARCH_CURSORS_MAX];
+  pthread_mutex_lock(&cursorsLock_g);
+  size_t numExpired = collectExpired(expired);
+  pthread_mutex_unlock(&cursorsLock_g);
+  freeExpired(expired, numExpired);
+}
+
+size_t SearchCursors_Count(void) {
+  pthread_mutex_lock(&cursorsLock_g);
+  size_t n = numCursors_g;
+  pthread_mutex_unlock(&cursorsLock_g);
+  return n;
+}
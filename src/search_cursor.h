@@ -0,0 +1,38 @@
+#ifndef __SEARCH_CURSOR_H__
+#define __SEARCH_CURSOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Coordinator side cursors of distributed searches. A cursor keeps the state of a search between
+ * reads, and is closed when it is idle for longer than its max idle time. A cursor is either
+ * paused, waiting for its next read, or taken by exactly one reader */
+
+/* The maximal number of open search cursors */
+#define SEARCH_CURSORS_MAX 128
+
+/* How often idle cursors are looked for and closed */
+#define SEARCH_CURSORS_SWEEP_INTERVAL_MS 1000
+
+typedef void (*SearchCursorFreeFunc)(void *state);
+
+/* Open a taken cursor over the state. Returns its id, or 0 if too many cursors are open */
+uint64_t SearchCursors_Add(void *state, SearchCursorFreeFunc freeState, long long maxIdleMS);
+
+/* Take a paused cursor, returning its state, or NULL if there is no such cursor or it is taken */
+void *SearchCursors_Take(uint64_t id);
+
+/* Pause a taken cursor until its next read, restarting its idle timer */
+void SearchCursors_Pause(uint64_t id);
+
+/* Close a taken cursor and free its state */
+void SearchCursors_Free(uint64_t id);
+
+/* Close the cursors that are idle for longer than their max idle time. Run periodically, every
+ * SEARCH_CURSORS_SWEEP_INTERVAL_MS, so idle cursors don't wait for the next cursor operation */
+void SearchCursors_Sweep(void *unused);
+
+/* The number of open search cursors */
+size_t SearchCursors_Count(void);
+
+#endif
@@ -0,0 +1,114 @@
+#include "search_result.h"
+#include "dep/rmr/fast_float.h"
+
+#include <stdlib.h>
+#include <sys/param.h>
+
+int cmpStrings(const char *s1, size_t l1, const char *s2, size_t l2) {
+  int cmp = memcmp(s1, s2, MIN(l1, l2));
+  if (l1 == l2) {
+    // if the strings are the same length, just return the result of strcmp
+    return cmp;
+  }
+
+  // if the strings are identical but the lengths aren't, return the longer string
+  if (cmp == 0) {
+    return l1 > l2 ? 1 : -1;
+  } else {  // the strings are lexically different, just return that
+    return cmp;
+  }
+}
+
+int cmpResultsByScore(const void *p1, const void *p2, const void *udata) {
+  const searchResult *r1 = p1, *r2 = p2;
+  double s1 = r1->score, s2 = r2->score;
+  if (s1 < s2) {
+    return 1;
+  } else if (s1 > s2) {
+    return -1;
+  } else {
+    // This was reversed to be more compatible with OSS version where tie breaker was changed 
+    // to return the lower doc ID to reduce sorting heap work. Doc name might not be ascending 
+    // or decending but this still may reduce heap work.
+    // Our tests are usually ascending so this will create similarity between RS and RSC.
+    return -cmpStrings(r2->id, r2->idLen, r1->id, r1->idLen);
+  }
+}
+
+static inline int cmpU64(uint64_t a, uint64_t b) {
+  return (a > b) - (a < b);
+}
+
+/* Compare by sorting keys in descending order, if at least one of the results has one */
+static inline int cmpSortKeys(const searchResult *r1, const searchResult *r2) {
+  int cmp = 0;
+  // Sort by numeric sorting keys
+  if (r1->sortKeyIsNum && r2->sortKeyIsNum) {
+    cmp = cmpU64(r2->sortKeyBits, r1->sortKeyBits);
+  } else if (r1->sortKey && r2->sortKey) {
+    // Sort by string sort keys, only going over the whole keys if their prefixes are equal
+    if (!r1->sortKeyIsNum && !r2->sortKeyIsNum) {
+      cmp = cmpU64(r2->sortKeyBits, r1->sortKeyBits);
+    }
+    if (!cmp) {
+      cmp = cmpStrings(r2->sortKey, r2->sortKeyLen, r1->sortKey, r1->sortKeyLen);
+    }
+  } else {
+    // If at least one of these has a sort key
+    cmp = r2->sortKey ? 1 : -1;
+  }
+  // in case of a tie - compare ids
+  if (!cmp) {
+    cmp = cmpStrings(r2->id, r2->idLen, r1->id, r1->idLen);
+  }
+  return cmp;
+}
+
+int cmpResultsBySortKeyDesc(const void *p1, const void *p2, const void *udata) {
+  const searchResult *r1 = p1, *r2 = p2;
+  if (!r1->sortKey && !r2->sortKey) {
+    return cmpResultsByScore(p1, p2, udata);
+  }
+  return cmpSortKeys(r1, r2);
+}
+
+int cmpResultsBySortKeyAsc(const void *p1, const void *p2, const void *udata) {
+  const searchResult *r1 = p1, *r2 = p2;
+  if (!r1->sortKey && !r2->sortKey) {
+    return cmpResultsByScore(p1, p2, udata);
+  }
+  return -cmpSortKeys(r1, r2);
+}
+
+/* The first 8 bytes of a string sort key, big endian and zero padded, which compare like
+ * cmpStrings does unless they are equal */
+static inline uint64_t encodeSortKeyPrefix(const char *s, size_t len) {
+  uint64_t prefix = 0;
+  for (size_t i = 0; i < sizeof(prefix); i++) {
+    prefix = (prefix << 8) | (i < len ? (uint8_t)s[i] : 0);
+  }
+  return prefix;
+}
+
+/* Parse a "#" prefixed numeric sort key, which must be a number in its entirety */
+static int parseSortKeyNum(const char *s, size_t len, double *d) {
+  if (len > 1 && fast_strtod(s + 1, len - 1, d) == len - 1) {
+    return 1;
+  }
+  char *eptr;
+  *d = strtod(s + 1, &eptr);
+  return eptr != s + 1 && *eptr == 0;
+}
+
+void searchResult_SetSortKey(searchResult *res, const char *sortKey, size_t len) {
+  double d;
+  res->sortKey = sortKey;
+  res->sortKeyLen = len;
+  if (sortKey[0] == '#' && parseSortKeyNum(sortKey, len, &d)) {
+    res->sortKeyIsNum = true;
+    res->sortKeyBits = encodeSortKeyNum(d);
+  } else {
+    res->sortKeyIsNum = false;
+    res->sortKeyBits = encodeSortKeyPrefix(sortKey, len);
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef __SEARCH_RESULT_H__
+#define __SEARCH_RESULT_H__
+
+#include "dep/rmr/reply.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* A result of a distributed search, pointing into the shard reply it was parsed from */
+typedef struct {
+  char *id;
+  size_t idLen;
+  // the length of the id as the shard sent it, with its tag if it has one
+  size_t keyLen;
+  double score;
+  MRReply *explainScores;
+  MRReply *fields;
+  MRReply *payload;
+  const char *sortKey;
+  size_t sortKeyLen;
+  // the sort key normalized once so the heap compares integers: an order-preserving encoding of
+  // numeric keys, or the first 8 bytes of string keys
+  uint64_t sortKeyBits;
+  bool sortKeyIsNum;
+  // the reply the result points into, when replies are folded as they arrive
+  struct searchReplyHolder *holder;
+} searchResult;
+
+/* Results are compared by a comparator picked once per request, so the top-K loop doesn't re-check
+ * the request's sort order on every comparison */
+typedef int (*searchResultCmp)(const void *p1, const void *p2, const void *udata);
+
+int cmpResultsByScore(const void *p1, const void *p2, const void *udata);
+/* Order by sorting keys, and by score when neither result has one */
+int cmpResultsBySortKeyDesc(const void *p1, const void *p2, const void *udata);
+int cmpResultsBySortKeyAsc(const void *p1, const void *p2, const void *udata);
+
+/* Compare strings like memcmp, with a string ordered after its prefixes */
+int cmpStrings(const char *s1, size_t l1, const char *s2, size_t l2);
+
+/* Set a result's sorting key from its string form, normalized for comparison */
+void searchResult_SetSortKey(searchResult *res, const char *sortKey, size_t len);
+
+/* Encode a double so that the encodings compare as unsigned integers in numeric order: negatives
+ * get all their bits flipped, positives only their sign bit */
+static inline uint64_t encodeSortKeyNum(double d) {
+  if (d == 0) d = 0;  // -0 and 0 are equal
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+/* The inverse of encodeSortKeyNum */
+static inline double decodeSortKeyNum(uint64_t bits) {
+  bits = (bits >> 63) ? bits & ~(1ULL << 63) : ~bits;
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+#endif
@@ -0,0 +1,241 @@
+#include "search_result.h"
+#include "minunit.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+
+/* The single comparator that checked the request's flags on every comparison, and kept numeric
+ * sort keys as doubles, before it was split into cmpResultsByScore and cmpResultsBySortKey*.
+ * Kept as the reference the split comparators must agree with */
+typedef struct {
+  const char *id;
+  size_t idLen;
+  double score;
+  const char *sortKey;
+  size_t sortKeyLen;
+  double sortKeyNum;
+} refResult;
+
+typedef struct {
+  int withSortby;
+  int sortAscending;
+} refRequest;
+
+static int refCmpResults(const void *p1, const void *p2, const void *udata) {
+  const refResult *r1 = p1, *r2 = p2;
+  const refRequest *req = udata;
+  if ((r1->sortKey || r2->sortKey) && req->withSortby) {
+    int cmp = 0;
+    if (r1->sortKeyNum != HUGE_VAL && r2->sortKeyNum != HUGE_VAL) {
+      double diff = r2->sortKeyNum - r1->sortKeyNum;
+      cmp = diff < 0 ? -1 : (diff > 0 ? 1 : 0);
+    } else if (r1->sortKey && r2->sortKey) {
+      cmp = cmpStrings(r2->sortKey, r2->sortKeyLen, r1->sortKey, r1->sortKeyLen);
+    } else {
+      cmp = r2->sortKey ? 1 : -1;
+    }
+    if (!cmp) {
+      cmp = cmpStrings(r2->id, r2->idLen, r1->id, r1->idLen);
+    }
+    return (req->sortAscending ? -cmp : cmp);
+  }
+
+  double s1 = r1->score, s2 = r2->score;
+  if (s1 < s2) {
+    return 1;
+  } else if (s1 > s2) {
+    return -1;
+  } else {
+    return -cmpStrings(r2->id, r2->idLen, r1->id, r1->idLen);
+  }
+}
+
+/* A result in both representations, built from the same id, score and sort key */
+typedef struct {
+  char id[16];
+  char sortKey[32];
+  refResult ref;
+  searchResult res;
+} testResult;
+
+static void setResult(testResult *t, int id, double score, const char *sortKey) {
+  snprintf(t->id, sizeof(t->id), "doc%d", id);
+  size_t idLen = strlen(t->id);
+  t->ref = (refResult){.id = t->id, .idLen = idLen, .score = score, .sortKeyNum = HUGE_VAL};
+  t->res = (searchResult){.id = t->id, .idLen = idLen, .keyLen = idLen, .score = score};
+  if (!sortKey) return;
+
+  snprintf(t->sortKey, sizeof(t->sortKey), "%s", sortKey);
+  size_t len = strlen(t->sortKey);
+  t->ref.sortKey = t->sortKey;
+  t->ref.sortKeyLen = len;
+  if (t->sortKey[0] == '#') {
+    char *eptr;
+    double d = strtod(t->sortKey + 1, &eptr);
+    if (eptr != t->sortKey + 1 && *eptr == 0) {
+      t->ref.sortKeyNum = d;
+    }
+  }
+  searchResult_SetSortKey(&t->res, t->sortKey, len);
+}
+
+/* Random results with many ties, mixing missing, numeric and string sort keys. String keys share
+ * prefixes longer than the 8 bytes the comparators look at first */
+static void randomResult(testResult *t) {
+  static const char *strs[] = {"",         "a",         "abc",       "aaaaaaaa", "aaaaaaaab",
+                               "aaaaaaaaX", "aaaaaaab", "aaaaaaaa\xff", "b",       "#x",
+                               "#",         "#1e",       "zzz"};
+  static const double nums[] = {-1e20, -2.5, -0.0, 0, 0.5, 1, 1.5, 3, 1e10, 1e20};
+  char buf[32];
+  const char *sortKey = NULL;
+  switch (rand() % 4) {
+    case 0:
+      break;
+    case 1:
+      snprintf(buf, sizeof(buf), "#%.17g", nums[rand() % (sizeof(nums) / sizeof(*nums))]);
+      sortKey = buf;
+      break;
+    case 2:
+      snprintf(buf, sizeof(buf), "#%d", rand() % 200 - 100);
+      sortKey = buf;
+      break;
+    default:
+      sortKey = strs[rand() % (sizeof(strs) / sizeof(*strs))];
+  }
+  setResult(t, rand() % 20, (rand() % 5) * 0.5, sortKey);
+}
+
+static searchResultCmp cmpFor(const refRequest *req) {
+  if (!req->withSortby) {
+    return cmpResultsByScore;
+  }
+  return req->sortAscending ? cmpResultsBySortKeyAsc : cmpResultsBySortKeyDesc;
+}
+
+static int sign(int x) {
+  return (x > 0) - (x < 0);
+}
+
+/* Every pair of results compares the same with the split comparators as with the reference, for
+ * every combination of the request's flags */
+void testCmpResultsEquivalence() {
+  const int n = 400;
+  testResult *results = malloc(n * sizeof(*results));
+  srand(1337);
+  for (int i = 0; i < n; i++) {
+    randomResult(&results[i]);
+  }
+
+  int mismatches = 0;
+  for (int flags = 0; flags < 4; flags++) {
+    refRequest req = {.withSortby = flags & 1, .sortAscending = (flags >> 1) & 1};
+    searchResultCmp cmp = cmpFor(&req);
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < n; j++) {
+        int expected = sign(refCmpResults(&results[i].ref, &results[j].ref, &req));
+        int actual = sign(cmp(&results[i].res, &results[j].res, NULL));
+        if (expected != actual && mismatches++ < 10) {
+          fprintf(stderr, "flags %d: %s '%s' vs %s '%s': expected %d, got %d\n", flags,
+                  results[i].id, results[i].ref.sortKey ? results[i].sortKey : "(none)",
+                  results[j].id, results[j].ref.sortKey ? results[j].sortKey : "(none)", expected,
+                  actual);
+        }
+      }
+    }
+  }
+  mu_assert_int_eq(0, mismatches);
+  free(results);
+}
+
+/* A few orderings spelled out */
+void testCmpResultsOrder() {
+  testResult a, b;
+  refRequest none = {0};
+
+  // higher scores first, ties broken by the lower id
+  setResult(&a, 1, 2, NULL);
+  setResult(&b, 2, 1, NULL);
+  mu_check(cmpResultsByScore(&a.res, &b.res, &none) < 0);
+  setResult(&b, 2, 2, NULL);
+  mu_check(cmpResultsByScore(&a.res, &b.res, &none) < 0);
+
+  // numeric keys compare as numbers, not as strings
+  setResult(&a, 1, 0, "#9");
+  setResult(&b, 1, 0, "#10");
+  mu_check(cmpResultsBySortKeyAsc(&a.res, &b.res, NULL) < 0);
+  mu_check(cmpResultsBySortKeyDesc(&a.res, &b.res, NULL) > 0);
+  setResult(&a, 1, 0, "#-0");
+  setResult(&b, 1, 0, "#0");
+  mu_assert_int_eq(0, cmpResultsBySortKeyAsc(&a.res, &b.res, NULL));
+
+  // string keys past their first 8 bytes
+  setResult(&a, 1, 0, "aaaaaaaab");
+  setResult(&b, 1, 0, "aaaaaaaac");
+  mu_check(cmpResultsBySortKeyAsc(&a.res, &b.res, NULL) < 0);
+  setResult(&b, 1, 0, "aaaaaaaa");
+  mu_check(cmpResultsBySortKeyAsc(&a.res, &b.res, NULL) > 0);
+
+  // a missing sort key is taken as smaller than any other
+  setResult(&b, 1, 5, NULL);
+  mu_check(cmpResultsBySortKeyAsc(&a.res, &b.res, NULL) > 0);
+  mu_check(cmpResultsBySortKeyDesc(&a.res, &b.res, NULL) < 0);
+}
+
+static double elapsedMS(struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* Compare the time per comparison of the reference and of the split comparators, for every
+ * combination of the request's flags. Only run when RMR_BENCHMARK is set */
+void testCmpResultsBenchmark() {
+  const int n = 4096, iterations = 10000000;
+  testResult *results = malloc(n * sizeof(*results));
+  srand(42);
+  for (int i = 0; i < n; i++) {
+    randomResult(&results[i]);
+  }
+
+  for (int flags = 0; flags < 4; flags++) {
+    refRequest req = {.withSortby = flags & 1, .sortAscending = (flags >> 1) & 1};
+    int (*volatile refCmp)(const void *, const void *, const void *) = refCmpResults;
+    searchResultCmp volatile cmp = cmpFor(&req);
+    long sum = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < iterations; i++) {
+      int a = i % n, b = (i * 7 + 1) % n;
+      sum += refCmp(&results[a].ref, &results[b].ref, &req);
+    }
+    double refMS = elapsedMS(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < iterations; i++) {
+      int a = i % n, b = (i * 7 + 1) % n;
+      sum += cmp(&results[a].res, &results[b].res, &req);
+    }
+    double cmpMS = elapsedMS(&start);
+
+    printf("withSortby %d sortAscending %d: reference %.2fns, split %.2fns per comparison (%ld)\n",
+           req.withSortby, req.sortAscending, refMS * 1e6 / iterations, cmpMS * 1e6 / iterations,
+           sum);
+  }
+  free(results);
+}
+
+int main(int argc, char **argv) {
+  MU_RUN_TEST(testCmpResultsOrder);
+  MU_RUN_TEST(testCmpResultsEquivalence);
+  if (getenv("RMR_BENCHMARK")) {
+    MU_RUN_TEST(testCmpResultsBenchmark);
+  }
+
+  MU_REPORT();
+  return minunit_status;
+}